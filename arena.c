@@ -0,0 +1,129 @@
+#include "mysh.h"
+
+/*
+ * Arène de la ligne de commande : l'arbre, les mots et les argv d'une ligne
+ * sont découpés dans un même bloc par simple incrément de pointeur, puis tout
+ * est rendu d'un coup par arena_reset() une fois la ligne exécutée.
+ * Quand une ligne a débordé sur plusieurs blocs, ils sont fusionnés en un seul
+ * au reset : les lignes suivantes de même taille ne font plus aucun malloc.
+ */
+
+#define ARENA_BLOCK_SIZE 16384
+#define ARENA_KEEP_MAX (1024 * 1024)
+#define ARENA_ALIGN 16
+
+arena_t line_arena;
+
+static arena_block_t *new_block(size_t size) {
+    arena_block_t *block = malloc(sizeof(arena_block_t) + size);
+    
+    if (block == NULL) {
+        perror("malloc");
+        return NULL;
+    }
+    
+    block->next = NULL;
+    block->size = size;
+    block->used = 0;
+    shell_stats.arena_mallocs++;
+    return block;
+}
+
+void *arena_alloc(arena_t *arena, size_t size) {
+    arena_block_t *block = arena->head;
+    void *ptr;
+    
+    size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    
+    if (block == NULL || block->size - block->used < size) {
+        size_t block_size = ARENA_BLOCK_SIZE;
+        while (block_size < size) {
+            block_size *= 2;
+        }
+        
+        block = new_block(block_size);
+        if (block == NULL) {
+            return NULL;
+        }
+        block->next = arena->head;
+        arena->head = block;
+    }
+    
+    ptr = block->data + block->used;
+    block->used += size;
+    arena->allocs++;
+    arena->bytes += size;
+    
+    return ptr;
+}
+
+/*
+ * Agrandit ptr (old_size octets) à new_size octets. Si c'est la dernière
+ * allocation du bloc courant et qu'il reste la place, elle est étendue sur
+ * place ; sinon le contenu est recopié dans une nouvelle zone.
+ */
+void *arena_grow(arena_t *arena, void *ptr, size_t old_size, size_t new_size) {
+    arena_block_t *block = arena->head;
+    size_t old_aligned = (old_size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    size_t new_aligned = (new_size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    void *copy;
+    
+    if (ptr != NULL && block != NULL &&
+        (char *)ptr + old_aligned == block->data + block->used &&
+        block->size - block->used >= new_aligned - old_aligned) {
+        block->used += new_aligned - old_aligned;
+        arena->bytes += new_aligned - old_aligned;
+        return ptr;
+    }
+    
+    copy = arena_alloc(arena, new_size);
+    if (copy != NULL && ptr != NULL) {
+        memcpy(copy, ptr, old_size);
+    }
+    return copy;
+}
+
+char *arena_strdup(arena_t *arena, const char *str) {
+    size_t len = strlen(str) + 1;
+    char *copy = arena_alloc(arena, len);
+    
+    if (copy != NULL) {
+        memcpy(copy, str, len);
+    }
+    return copy;
+}
+
+/* Rend toute la mémoire de la ligne et comptabilise son coût pour mystats */
+void arena_reset(arena_t *arena) {
+    arena_block_t *block = arena->head;
+    size_t total = 0;
+    
+    if (arena->allocs > 0) {
+        shell_stats.arena_lines++;
+        shell_stats.arena_allocs += arena->allocs;
+        shell_stats.arena_bytes += arena->bytes;
+        if (arena->bytes > shell_stats.arena_max_bytes) {
+            shell_stats.arena_max_bytes = arena->bytes;
+        }
+    }
+    arena->allocs = 0;
+    arena->bytes = 0;
+    
+    if (block == NULL) {
+        return;
+    }
+    
+    if (block->next == NULL) {
+        block->used = 0;
+        return;
+    }
+    
+    while (block != NULL) {
+        arena_block_t *next = block->next;
+        total += block->size;
+        free(block);
+        block = next;
+    }
+    
+    arena->head = (total <= ARENA_KEEP_MAX) ? new_block(total) : NULL;
+}
@@ -0,0 +1,92 @@
+#!/bin/bash
+# Mesures de performance de mysh
+# Usage: ./bench.sh [spawn|env|tee] ...   (sans argument : toutes les mesures)
+
+MYSH=./mysh
+OUT=bench_output.txt
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+
+make -s mysh || exit 1
+: > "$OUT"
+
+log() {
+    echo "$@" | tee -a "$OUT"
+}
+
+# Coût fork -> exec selon le moteur, avec un tas de shell petit puis gros
+bench_spawn() {
+    local n=${SPAWN_RUNS:-2000}
+    local heap=${SPAWN_HEAP_VARS:-20000}
+    local filler
+    filler=$(head -c 4000 /dev/zero | tr '\0' 'x')
+
+    log "=== spawn : $n lancements de /bin/true ==="
+    for size in 0 "$heap"; do
+        for mode in fork posix; do
+            {
+                for ((i = 0; i < size; i++)); do
+                    echo "set heap$i=$filler"
+                done
+                echo "myopt spawn=$mode"
+                echo "mystats reset"
+                for ((i = 0; i < n; i++)); do
+                    echo "/bin/true"
+                done
+                echo "mystats"
+            } > "$TMP/spawn.sh"
+            log "-- $mode, $size variables de 4 Ko dans le tas"
+            $MYSH < "$TMP/spawn.sh" | tr '>' '\n' | grep "spawn $mode" | sed 's/^ //' | tee -a "$OUT"
+        done
+    done
+}
+
+# Lectures concurrentes de l'environnement partagé, avec ou sans écrivain
+bench_env() {
+    local n=${ENV_READS:-20000}
+    local shells=${ENV_SHELLS:-4}
+    local start end
+
+    for ((i = 0; i < n; i++)); do
+        echo "set v=\$BENCH_VAR"
+    done > "$TMP/read.sh"
+    echo "mystats" >> "$TMP/read.sh"
+    for ((i = 0; i < n; i++)); do
+        echo "setenv BENCH_VAR=$i"
+    done > "$TMP/write.sh"
+
+    log "=== env : $shells shells lisent \$BENCH_VAR $n fois chacun ==="
+    for writers in 0 1; do
+        start=$(date +%s%N)
+        for ((s = 0; s < shells; s++)); do
+            BENCH_VAR=x $MYSH < "$TMP/read.sh" > "$TMP/read$s.out" &
+        done
+        if [ "$writers" = 1 ]; then
+            BENCH_VAR=x $MYSH < "$TMP/write.sh" > /dev/null &
+        fi
+        wait
+        end=$(date +%s%N)
+        log "-- $writers écrivain : $(( (end - start) / 1000000 )) ms"
+        cat "$TMP"/read*.out | tr '>' '\n' | grep "^ *env " | sed 's/^ //' | tee -a "$OUT"
+    done
+}
+
+# Duplication d'un flux : tee de coreutils contre le builtin mytee (tee/splice)
+bench_tee() {
+    local mb=${TEE_MB:-2048}
+    local start end
+
+    log "=== tee : $mb Mo de /dev/zero vers un fichier et un tube ==="
+    for cmd in tee mytee; do
+        echo "head -c ${mb}M /dev/zero | $cmd $TMP/tee.out | cat > /dev/null" > "$TMP/tee.sh"
+        start=$(date +%s%N)
+        $MYSH < "$TMP/tee.sh" > /dev/null
+        end=$(date +%s%N)
+        log "-- $cmd : $(( (end - start) / 1000000 )) ms, $(( mb * 1000000000 / (end - start + 1) )) Mo/s"
+        rm -f "$TMP/tee.out"
+    done
+}
+
+for bench in ${@:-spawn env tee}; do
+    "bench_$bench"
+done
@@ -10,7 +10,12 @@ int is_builtin(char *cmd) {
             strcmp(cmd, "set") == 0 ||
             strcmp(cmd, "unset") == 0 ||
             strcmp(cmd, "setenv") == 0 ||
-            strcmp(cmd, "unsetenv") == 0);
+            strcmp(cmd, "unsetenv") == 0 ||
+            strcmp(cmd, "myopt") == 0 ||
+            strcmp(cmd, "mystats") == 0 ||
+            strcmp(cmd, "hash") == 0 ||
+            strcmp(cmd, "mywaitenv") == 0 ||
+            strcmp(cmd, "mytee") == 0);
 }
 
 int execute_builtin(command_t *cmd) {
@@ -68,6 +73,16 @@ int execute_builtin(command_t *cmd) {
         }
         unset_env_variable(cmd->argv[1]);
         return 0;
+    } else if (strcmp(cmd->argv[0], "myopt") == 0) {
+        return builtin_myopt(cmd->argv);
+    } else if (strcmp(cmd->argv[0], "mystats") == 0) {
+        return builtin_mystats(cmd->argv);
+    } else if (strcmp(cmd->argv[0], "hash") == 0) {
+        return builtin_hash(cmd->argv);
+    } else if (strcmp(cmd->argv[0], "mywaitenv") == 0) {
+        return builtin_waitenv(cmd->argv);
+    } else if (strcmp(cmd->argv[0], "mytee") == 0) {
+        return builtin_mytee(cmd->argv);
     }
     
     return 1;
@@ -129,6 +144,13 @@ int builtin_myfg(char **argv) {
     int job_id;
     job_t *job;
     int status;
+    pid_t pgid;
+    pid_t pid;
+    sigset_t saved_mask;
+    
+    /* Le statut du job ne doit pas être récolté par le gestionnaire pendant l'attente */
+    block_sigchld(&saved_mask);
+    check_background_jobs();
     
     if (argv[1] != NULL) {
         job_id = atoi(argv[1]);
@@ -140,31 +162,34 @@ int builtin_myfg(char **argv) {
     
     if (job == NULL) {
         fprintf(stderr, "myfg: no such job\n");
+        restore_sigmask(&saved_mask);
         return 1;
     }
     
     /* SIGCONT  */
     if (job->state == JOB_STOPPED) {
-        kill(job->pid, SIGCONT);
+        signal_job(job, SIGCONT);
+        job->state = JOB_RUNNING;
     }
     
-    foreground_pid = job->pid;
-    tcsetpgrp(STDIN_FILENO, job->pid);
-    
-    /* Wait */
-    if (waitpid(job->pid, &status, WUNTRACED) < 0) {
-        perror("waitpid");
-        return 1;
+    pgid = job->pgid;
+    pid = job->pid;
+    foreground_pid = pid;
+    if (pgid > 0) {
+        tcsetpgrp(STDIN_FILENO, pgid);
     }
     
-    tcsetpgrp(STDIN_FILENO, getpgrp());
+    /* Wait : le job est retiré de la table s'il se termine */
+    status = wait_job(job);
+    restore_sigmask(&saved_mask);
+    
+    if (pgid > 0) {
+        tcsetpgrp(STDIN_FILENO, getpgrp());
+    }
     foreground_pid = -1;
     
-    if (WIFEXITED(status) || WIFSIGNALED(status)) {
-        remove_job(job_id);
-    } else if (WIFSTOPPED(status)) {
-        job->state = JOB_STOPPED;
-        printf("\n[%d] %d Stoppé %s\n", job_id, job->pid, job->command);
+    if (status == -1) {
+        printf("\n[%d] %d Stoppé %s\n", job_id, pid, job->command);
     }
     
     return 0;
@@ -192,10 +217,171 @@ int builtin_mybg(char **argv) {
         return 1;
     }
     
-    kill(job->pid, SIGCONT);
+    signal_job(job, SIGCONT);
     job->state = JOB_RUNNING;
     
     printf("[%d] %d %s &\n", job_id, job->pid, job->command);
     
     return 0;
 }
+
+static const char *spawn_mode_names[] = { "fork", "posix" };
+static const char *glob_mode_names[] = { "libc", "builtin" };
+
+int builtin_myopt(char **argv) {
+    if (argv[1] == NULL) {
+        printf("spawn=%s\n", spawn_mode_names[shell_opts.spawn_mode]);
+        printf("glob=%s\n", glob_mode_names[shell_opts.glob_mode]);
+        printf("globthreads=%d\n", shell_opts.glob_threads);
+        printf("batch=%s\n", shell_opts.batch ? "on" : "off");
+        printf("batchjobs=%d\n", shell_opts.batch_jobs);
+        printf("pipestat=%s\n", shell_opts.pipe_stat ? "on" : "off");
+        printf("pipesize=%d\n", shell_opts.pipe_size);
+        return 0;
+    }
+    
+    for (int i = 1; argv[i] != NULL; i++) {
+        char *eq = strchr(argv[i], '=');
+        if (eq == NULL) {
+            fprintf(stderr, "myopt: invalid format, use option=value\n");
+            return 1;
+        }
+        *eq = '\0';
+        char *value = eq + 1;
+        int ok = 0;
+        
+        if (strcmp(argv[i], "spawn") == 0) {
+            if (strcmp(value, "fork") == 0) {
+                shell_opts.spawn_mode = SPAWN_FORK;
+                ok = 1;
+            } else if (strcmp(value, "posix") == 0) {
+                shell_opts.spawn_mode = SPAWN_POSIX;
+                ok = 1;
+            }
+        } else if (strcmp(argv[i], "glob") == 0) {
+            if (strcmp(value, "libc") == 0) {
+                shell_opts.glob_mode = GLOB_LIBC;
+                ok = 1;
+            } else if (strcmp(value, "builtin") == 0) {
+                shell_opts.glob_mode = GLOB_BUILTIN;
+                ok = 1;
+            }
+        } else if (strcmp(argv[i], "globthreads") == 0) {
+            char *end;
+            long threads = strtol(value, &end, 10);
+            if (*value != '\0' && *end == '\0' && threads >= 0 && threads <= 64) {
+                shell_opts.glob_threads = threads;
+                ok = 1;
+            }
+        } else if (strcmp(argv[i], "batch") == 0) {
+            if (strcmp(value, "on") == 0 || strcmp(value, "off") == 0) {
+                shell_opts.batch = (value[1] == 'n');
+                ok = 1;
+            }
+        } else if (strcmp(argv[i], "batchjobs") == 0) {
+            char *end;
+            long jobs = strtol(value, &end, 10);
+            if (*value != '\0' && *end == '\0' && jobs >= 1 && jobs <= 1024) {
+                shell_opts.batch_jobs = jobs;
+                ok = 1;
+            }
+        } else if (strcmp(argv[i], "pipestat") == 0) {
+            if (strcmp(value, "on") == 0 || strcmp(value, "off") == 0) {
+                shell_opts.pipe_stat = (value[1] == 'n');
+                ok = 1;
+            }
+        } else if (strcmp(argv[i], "pipesize") == 0) {
+            char *end;
+            long size = strtol(value, &end, 10);
+            int pipefd[2];
+            
+            /* La taille est essayée sur un tube : le noyau peut la refuser
+             * (au-delà de /proc/sys/fs/pipe-max-size sans privilège) */
+            if (*value != '\0' && *end == '\0' && size == 0) {
+                shell_opts.pipe_size = 0;
+                ok = 1;
+            } else if (*value != '\0' && *end == '\0' && size > 0 && size <= INT_MAX &&
+                       pipe(pipefd) == 0) {
+                int got = fcntl(pipefd[1], F_SETPIPE_SZ, (int)size);
+                
+                if (got < 0) {
+                    perror("myopt: pipesize");
+                } else {
+                    shell_opts.pipe_size = got;
+                    ok = 1;
+                }
+                close(pipefd[0]);
+                close(pipefd[1]);
+            }
+        }
+        
+        if (!ok) {
+            fprintf(stderr, "myopt: invalid option %s=%s\n", argv[i], value);
+            *eq = '=';
+            return 1;
+        }
+        *eq = '=';
+    }
+    
+    return 0;
+}
+
+int builtin_mystats(char **argv) {
+    if (argv[1] != NULL && strcmp(argv[1], "reset") == 0) {
+        memset(&shell_stats, 0, sizeof(shell_stats));
+        return 0;
+    }
+    
+    /* Coût côté shell de la création d'un processus jusqu'à la reprise du parent */
+    for (int mode = SPAWN_FORK; mode <= SPAWN_POSIX; mode++) {
+        unsigned long count = shell_stats.spawn_count[mode];
+        
+        printf("spawn %-5s : %lu processus", spawn_mode_names[mode], count);
+        if (count > 0) {
+            printf(", moyenne %.1f us, max %.1f us",
+                   shell_stats.spawn_ns[mode] / 1000.0 / count,
+                   shell_stats.spawn_max_ns[mode] / 1000.0);
+        }
+        printf("\n");
+    }
+    
+    /* Temps d'expansion d'un argument contenant un motif, par moteur */
+    for (int mode = GLOB_LIBC; mode <= GLOB_BUILTIN; mode++) {
+        unsigned long count = shell_stats.glob_count[mode];
+        
+        printf("glob %-7s: %lu motifs", glob_mode_names[mode], count);
+        if (count > 0) {
+            printf(", moyenne %.1f us, max %.1f us",
+                   shell_stats.glob_ns[mode] / 1000.0 / count,
+                   shell_stats.glob_max_ns[mode] / 1000.0);
+        }
+        printf("\n");
+    }
+    printf("glob groupés: %lu motifs en %lu lectures de répertoire\n",
+           shell_stats.glob_grouped, shell_stats.glob_groups);
+    printf("dircache    : %lu réutilisations, %lu lectures\n",
+           shell_stats.dircache_hits, shell_stats.dircache_misses);
+    printf("globstar    : %lu parcours, %lu répertoires lus\n",
+           shell_stats.globstar_walks, shell_stats.globstar_dirs);
+    
+    printf("env         : %lu lectures, %lu reprises, %lu remappages, %lu envp reconstruits\n",
+           shell_stats.env_reads, shell_stats.env_retries, shell_stats.env_remaps,
+           shell_stats.env_builds);
+    printf("batch       : %lu commandes découpées, %lu lots\n",
+           shell_stats.batch_commands, shell_stats.batch_runs);
+    printf("relais      : %lu tubes, %llu octets\n",
+           shell_stats.relay_pipes, shell_stats.relay_bytes);
+    
+    /* Mémoire des lignes analysées, prise dans line_arena */
+    unsigned long lines = shell_stats.arena_lines;
+    printf("arena       : %lu lignes, %lu malloc", lines, shell_stats.arena_mallocs);
+    if (lines > 0) {
+        printf(", %.1f allocations et %.0f octets par ligne, max %llu octets",
+               (double)shell_stats.arena_allocs / lines,
+               (double)shell_stats.arena_bytes / lines,
+               shell_stats.arena_max_bytes);
+    }
+    printf("\n");
+    
+    return 0;
+}
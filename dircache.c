@@ -0,0 +1,218 @@
+#include "mysh.h"
+
+/*
+ * Cache des contenus de répertoires pour l'expansion des motifs.
+ * Une liste lue par readdir est gardée, triée, sous la clé (dev, ino) et
+ * reste valable tant que la date de modification du répertoire ne change
+ * pas : un motif relancé dans le même répertoire ne coûte qu'un stat.
+ * Un répertoire modifié juste avant sa lecture n'est pas réutilisé, une
+ * seconde modification dans le même tic d'horloge passerait inaperçue.
+ */
+
+#define DIRCACHE_BUCKETS 64
+#define DIRCACHE_MAX_DIRS 256
+#define DIRCACHE_RACY_NS 20000000LL
+
+static dir_listing_t *buckets[DIRCACHE_BUCKETS];
+static int cached_dirs = 0;
+static unsigned long use_clock = 0;
+
+static unsigned int dir_hash(dev_t dev, ino_t ino) {
+    return (unsigned int)((ino * 2654435761u) ^ dev) & (DIRCACHE_BUCKETS - 1);
+}
+
+static long long timespec_ns(const struct timespec *ts) {
+    return (long long)ts->tv_sec * 1000000000LL + ts->tv_nsec;
+}
+
+static int compare_entries(const void *a, const void *b) {
+    return strcmp(((const dir_entry_t *)a)->name, ((const dir_entry_t *)b)->name);
+}
+
+static void free_listing(dir_listing_t *listing) {
+    free(listing->entries);
+    free(listing->names);
+    free(listing);
+}
+
+static void unlink_listing(dir_listing_t *listing) {
+    dir_listing_t **slot = &buckets[dir_hash(listing->dev, listing->ino)];
+    
+    while (*slot != listing) {
+        slot = &(*slot)->next;
+    }
+    *slot = listing->next;
+    cached_dirs--;
+}
+
+/* Retire la liste la moins récemment utilisée qui n'est pas en cours d'usage */
+static void evict_one(void) {
+    dir_listing_t *victim = NULL;
+    
+    for (int b = 0; b < DIRCACHE_BUCKETS; b++) {
+        for (dir_listing_t *l = buckets[b]; l != NULL; l = l->next) {
+            if (l->pins == 0 && (victim == NULL || l->last_use < victim->last_use)) {
+                victim = l;
+            }
+        }
+    }
+    
+    if (victim != NULL) {
+        unlink_listing(victim);
+        free_listing(victim);
+    }
+}
+
+/* Lit le répertoire path : noms dans un seul bloc, entrées triées */
+static dir_listing_t *read_listing(const char *path) {
+    dir_listing_t *listing = calloc(1, sizeof(dir_listing_t));
+    size_t names_size = 0;
+    size_t names_cap = 4096;
+    int cap = 64;
+    int failed = 0;
+    struct dirent *entry;
+    DIR *dir;
+    
+    if (listing == NULL) {
+        return NULL;
+    }
+    
+    dir = opendir(path);
+    if (dir == NULL) {
+        free(listing);
+        return NULL;
+    }
+    
+    listing->names = malloc(names_cap);
+    listing->entries = malloc(sizeof(dir_entry_t) * cap);
+    if (listing->names == NULL || listing->entries == NULL) {
+        closedir(dir);
+        free_listing(listing);
+        return NULL;
+    }
+    
+    /* Les noms sont rangés par décalage tant que le bloc peut encore bouger */
+    while ((entry = readdir(dir)) != NULL) {
+        size_t len = strlen(entry->d_name) + 1;
+        
+        if (names_size + len > names_cap) {
+            char *grown;
+            while (names_size + len > names_cap) {
+                names_cap *= 2;
+            }
+            grown = realloc(listing->names, names_cap);
+            if (grown == NULL) {
+                failed = 1;
+                break;
+            }
+            listing->names = grown;
+        }
+        if (listing->count == cap) {
+            dir_entry_t *grown = realloc(listing->entries, sizeof(dir_entry_t) * cap * 2);
+            if (grown == NULL) {
+                failed = 1;
+                break;
+            }
+            listing->entries = grown;
+            cap *= 2;
+        }
+        
+        memcpy(listing->names + names_size, entry->d_name, len);
+        listing->entries[listing->count].offset = names_size;
+        listing->entries[listing->count].len = len - 1;
+        listing->entries[listing->count].type = entry->d_type;
+        listing->count++;
+        names_size += len;
+    }
+    closedir(dir);
+    
+    /* Une liste incomplète ne doit pas entrer dans le cache */
+    if (failed) {
+        perror("realloc");
+        free_listing(listing);
+        return NULL;
+    }
+    
+    for (int i = 0; i < listing->count; i++) {
+        listing->entries[i].name = listing->names + listing->entries[i].offset;
+    }
+    qsort(listing->entries, listing->count, sizeof(dir_entry_t), compare_entries);
+    
+    return listing;
+}
+
+/*
+ * Renvoie le contenu du répertoire path ("" pour le répertoire courant), ou
+ * NULL s'il ne peut pas être lu. La liste reste valable jusqu'à
+ * dircache_release(), même si d'autres répertoires sont lus entre-temps.
+ */
+dir_listing_t *dircache_get(const char *path) {
+    struct stat st;
+    struct timespec now;
+    dir_listing_t **slot;
+    dir_listing_t *listing;
+    
+    if (*path == '\0') {
+        path = ".";
+    }
+    
+    if (stat(path, &st) < 0 || !S_ISDIR(st.st_mode)) {
+        return NULL;
+    }
+    
+    slot = &buckets[dir_hash(st.st_dev, st.st_ino)];
+    for (listing = *slot; listing != NULL; listing = listing->next) {
+        if (listing->dev == st.st_dev && listing->ino == st.st_ino) {
+            break;
+        }
+    }
+    
+    if (listing != NULL) {
+        if (listing->valid &&
+            timespec_ns(&listing->mtime) == timespec_ns(&st.st_mtim)) {
+            shell_stats.dircache_hits++;
+            listing->pins++;
+            listing->last_use = ++use_clock;
+            return listing;
+        }
+        /* Répertoire modifié : la liste est relue */
+        if (listing->pins == 0) {
+            unlink_listing(listing);
+            free_listing(listing);
+        } else {
+            unlink_listing(listing);
+            listing->orphan = 1;
+        }
+    }
+    
+    if (cached_dirs >= DIRCACHE_MAX_DIRS) {
+        evict_one();
+    }
+    
+    clock_gettime(CLOCK_REALTIME, &now);
+    listing = read_listing(path);
+    if (listing == NULL) {
+        return NULL;
+    }
+    shell_stats.dircache_misses++;
+    
+    listing->dev = st.st_dev;
+    listing->ino = st.st_ino;
+    listing->mtime = st.st_mtim;
+    listing->valid = (timespec_ns(&now) - timespec_ns(&st.st_mtim) > DIRCACHE_RACY_NS);
+    listing->pins = 1;
+    listing->last_use = ++use_clock;
+    
+    slot = &buckets[dir_hash(st.st_dev, st.st_ino)];
+    listing->next = *slot;
+    *slot = listing;
+    cached_dirs++;
+    
+    return listing;
+}
+
+void dircache_release(dir_listing_t *listing) {
+    if (--listing->pins == 0 && listing->orphan) {
+        free_listing(listing);
+    }
+}
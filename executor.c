@@ -1,212 +1,625 @@
 #include "mysh.h"
 
-int execute_simple_command(command_t *cmd) {
-    pid_t pid;
-    int status;
+/* Met à jour last_status d'après un statut de waitpid */
+static int set_last_status(int status) {
+    if (WIFEXITED(status)) {
+        last_status = WEXITSTATUS(status);
+    } else if (WIFSIGNALED(status)) {
+        last_status = -1;
+    }
+    return last_status;
+}
+
+/*
+ * Lance les count premières étapes de cmd reliées par des tubes, sans attendre.
+ * pgid vaut -1 pour rester dans le groupe du shell, 0 pour créer un groupe dont
+ * la première étape lancée est le chef. pids[i] vaut -1 pour une étape qui n'a
+ * pas pu être lancée, *spawn_status reçoit alors son code de retour.
+ * Si tail_fd n'est pas NULL, la dernière étape écrit elle aussi dans un tube
+ * dont l'extrémité de lecture est rendue dans *tail_fd.
+ * Si relays n'est pas NULL, chaque étape a son propre tube de sortie et
+ * relays[i] garde les extrémités que le shell relie entre l'étape i et la
+ * suivante (voir relay.c).
+ */
+static void launch_pipeline(command_t *cmd, int count, pid_t pgid, pid_t *pids, int *spawn_status,
+                            int *tail_fd, relay_t *relays) {
+    command_t *current = cmd;
+    int prev_read = -1;
+    int pipefd[2];
     
-    if (cmd->argc == 0) {
-        return 0;
+    /* Les tubes sont créés au fur et à mesure en O_CLOEXEC : chaque fils
+     * n'hérite que des extrémités qui le concernent */
+    for (int i = 0; i < count; i++, current = current->next) {
+        int fd_out = -1;
+        int next_read = -1;
+        
+        pipefd[0] = pipefd[1] = -1;
+        if (i < count - 1 || tail_fd != NULL) {
+            if (pipe2(pipefd, O_CLOEXEC) < 0) {
+                perror("pipe");
+                pipefd[0] = pipefd[1] = -1;
+            }
+            set_pipe_size(pipefd[1]);
+            fd_out = pipefd[1];
+            next_read = pipefd[0];
+        }
+        
+        if (relays != NULL && i < count - 1) {
+            int relayfd[2];
+            
+            /* L'étape suivante lit un second tube, rempli par le relais ;
+             * sans lui, les deux étapes restent reliées directement */
+            relays[i].in = relays[i].out = -1;
+            relays[i].capacity = fcntl(pipefd[0], F_GETPIPE_SZ);
+            if (pipefd[0] >= 0 && pipe2(relayfd, O_CLOEXEC) < 0) {
+                perror("pipe");
+            } else if (pipefd[0] >= 0) {
+                set_pipe_size(relayfd[1]);
+                relays[i].in = pipefd[0];
+                relays[i].out = relayfd[1];
+                relays[i].capacity = fcntl(relayfd[1], F_GETPIPE_SZ);
+                next_read = relayfd[0];
+            }
+        }
+        
+        pids[i] = spawn_process(current, prev_read, fd_out, pgid, spawn_status);
+        if (pgid == 0 && pids[i] > 0) {
+            pgid = pids[i];
+        }
+        
+        if (prev_read >= 0) {
+            close(prev_read);
+        }
+        if (fd_out >= 0) {
+            close(fd_out);
+        }
+        prev_read = next_read;
     }
     
-    /* Check builtin */
-    if (is_builtin(cmd->argv[0])) {
-        return execute_builtin(cmd);
+    if (tail_fd != NULL) {
+        *tail_fd = prev_read;
+    } else if (prev_read >= 0) {
+        close(prev_read);
     }
+}
+
+/*
+ * Exécute un builtin dans le shell, fd_in (-1 : aucun) sur son entrée et ses
+ * redirections appliquées le temps de l'appel.
+ */
+static int run_builtin(command_t *cmd, int fd_in) {
+    saved_fd_t *saved = redirect_in_shell(cmd, fd_in);
+    int status;
     
-    /* Fork and execute */
-    pid = fork();
-    if (pid < 0) {
-        perror("fork");
-        return -1;
+    if (saved == NULL) {
+        return 1;
     }
+    status = execute_builtin(cmd);
+    restore_redirections(saved);
+    return status;
+}
+
+/* Fait des n processus de pids, stoppés par Ctrl-Z, un job stoppé */
+static void add_stopped_job(pid_t *pids, int n, char *name) {
+    job_t *job = add_job(pids, n, 0, name);
     
-    if (pid == 0) {
-        /* processus fils */
+    if (job != NULL) {
+        job->state = JOB_STOPPED;
+        printf("\n[%d] %d Stoppé %s\n", job->job_id, job->pid, name);
+    }
+}
+
+/*
+ * Attend les processus d'une commande au premier plan. Si l'un d'eux est
+ * stoppé (Ctrl-Z), ceux qui restent deviennent un job stoppé et *stopped vaut 1.
+ */
+static int wait_foreground(pid_t *pids, int count, char *name, int *stopped) {
+    int status = 0;
+    
+    *stopped = 0;
+    
+    for (int i = 0; i < count; i++) {
+        if (pids[i] <= 0) {
+            continue;
+        }
         
-        if (setup_redirections(cmd) < 0) {
-            exit(1);
+        foreground_pid = pids[i];
+        if (waitpid(pids[i], &status, WUNTRACED) < 0) {
+            perror("waitpid");
+            continue;
         }
         
-        execvp(cmd->argv[0], cmd->argv);
-        perror(cmd->argv[0]);
-        exit(127);
+        if (WIFSTOPPED(status)) {
+            /* Les processus restants sont tassés sur place derrière pids[i] */
+            int n = 0;
+            
+            for (int j = i; j < count; j++) {
+                if (pids[j] > 0) {
+                    pids[i + n++] = pids[j];
+                }
+            }
+            
+            add_stopped_job(pids + i, n, name);
+            *stopped = 1;
+            break;
+        }
     }
     
-    /* processus parent */
-    foreground_pid = pid;
+    foreground_pid = -1;
+    return status;
+}
+
+/* Marge gardée sous ARG_MAX, comme xargs */
+#define ARG_MAX_HEADROOM 4096
+
+/* Place occupée par une chaîne passée à execve : son texte et son pointeur */
+static size_t exec_size(const char *str) {
+    return strlen(str) + 1 + sizeof(char *);
+}
+
+/* Octets disponibles pour argv une fois l'environnement compté */
+static long argv_room(void) {
+    long room = sysconf(_SC_ARG_MAX);
     
-    if (last_command != NULL) {
-        free(last_command);
+    if (room <= 0) {
+        room = 128 * 1024;
     }
-    last_command = strdup(cmd->argv[0]);
-    
-    if (waitpid(pid, &status, WUNTRACED) < 0) {
-        perror("waitpid");
-        return -1;
+    room -= ARG_MAX_HEADROOM + sizeof(char *);
+    for (char **env = get_env_array(); *env != NULL; env++) {
+        room -= exec_size(*env);
     }
+    return room;
+}
+
+/*
+ * Vrai si l'argv de cmd dépasse ARG_MAX et peut être découpé en lots : la
+ * plus grande expansion doit finir la ligne, sinon les mots qui la suivent
+ * (mv *.c a dst) seraient répétés dans chaque lot.
+ */
+static int needs_batching(command_t *cmd) {
+    long room;
     
-    foreground_pid = -1;
-    
-    if (WIFEXITED(status)) {
-        last_status = WEXITSTATUS(status);
-        return last_status;
-    } else if (WIFSIGNALED(status)) {
-        last_status = -1;
-        return -1;
-    } else if (WIFSTOPPED(status)) {
-        printf("\n[%d] %d Stoppé %s\n", ++job_counter, pid, cmd->argv[0]);
-        job_t *job = add_job(pid, cmd->argv[0]);
-        if (job != NULL) {
-            job->state = JOB_STOPPED;
-        }
+    if (!shell_opts.batch || cmd->glob_count < 2 ||
+        cmd->glob_start + cmd->glob_count != cmd->argc) {
         return 0;
     }
     
+    room = argv_room() - sizeof(char *);
+    for (int i = 0; i < cmd->argc; i++) {
+        room -= exec_size(cmd->argv[i]);
+        if (room < 0) {
+            return 1;
+        }
+    }
     return 0;
 }
 
-int execute_pipeline(command_t *cmd) {
-    int num_cmds = 0;
-    int pipefd[MAX_ARGS][2];
-    pid_t pids[MAX_ARGS];
-    command_t *current;
-    int i = 0;
-    int status;
-    
-    //nb commandes
-    for (current = cmd; current != NULL; current = current->next) {
-        num_cmds++;
+/* Variante en ajout d'une redirection qui tronque */
+static redir_type_t append_redirection(redir_type_t type) {
+    switch (type) {
+        case REDIR_OUT:
+            return REDIR_OUT_APPEND;
+        case REDIR_BOTH:
+            return REDIR_BOTH_APPEND;
+        default:
+            return type;
     }
+}
+
+/*
+ * Copie des redirections de cmd pour les lots : chaque fichier à tronquer
+ * l'est une fois ici, puis tous les lots y écrivent à la suite et des lots
+ * parallèles ne s'écrasent pas. Renvoie -1 si un fichier ne s'ouvre pas.
+ */
+static int batch_redirections(command_t *cmd, redirection_t **copy) {
+    redirection_t **tail = copy;
     
-    for (i = 0; i < num_cmds - 1; i++) {
-        if (pipe(pipefd[i]) < 0) {
-            perror("pipe");
+    *copy = NULL;
+    for (redirection_t *redir = cmd->redirs; redir != NULL; redir = redir->next) {
+        redirection_t *dup = arena_alloc(&line_arena, sizeof(redirection_t));
+        
+        if (dup == NULL) {
             return -1;
         }
+        *dup = *redir;
+        dup->next = NULL;
+        if (append_redirection(redir->type) != redir->type) {
+            int fd = open_redirection(redir);
+            if (fd < 0) {
+                return -1;
+            }
+            close(fd);
+            dup->type = append_redirection(redir->type);
+        }
+        *tail = dup;
+        tail = &dup->next;
+    }
+    return 0;
+}
+
+/*
+ * Exécute cmd en plusieurs fois, comme xargs : l'expansion de motif qui
+ * termine la ligne est répartie en lots aussi gros que possible, les mots
+ * placés avant elle sont repris dans chaque lot. Jusqu'à batch_jobs lots
+ * tournent en même temps. Le statut est le plus grand code de retour des
+ * lots, -1 si l'un d'eux a été tué par un signal. Un Ctrl-Z fait des lots
+ * en cours un seul job stoppé ; ceux qui n'étaient pas lancés sont annulés.
+ */
+static int execute_batched(command_t *cmd) {
+    int head = cmd->glob_start;
+    int next = cmd->glob_start;
+    int end = cmd->argc;
+    int jobs = shell_opts.batch_jobs;
+    long fixed = argv_room() - sizeof(char *);
+    pid_t *running = arena_alloc(&line_arena, sizeof(pid_t) * jobs);
+    int nrunning = 0;
+    int worst = 0;
+    int killed = 0;
+    int stopped = 0;
+    sigset_t saved_mask;
+    command_t batch = *cmd;
+    
+    if (running == NULL) {
+        return 1;
     }
     
-    i = 0;
-    for (current = cmd; current != NULL; current = current->next) {
-        pids[i] = fork();
-        
-        if (pids[i] < 0) {
-            perror("fork");
-            return -1;
-        }
+    for (int i = 0; i < head; i++) {
+        fixed -= exec_size(cmd->argv[i]);
+    }
+    
+    if (batch_redirections(cmd, &batch.redirs) < 0) {
+        last_status = 1;
+        return 1;
+    }
+    
+    shell_stats.batch_commands++;
+    block_sigchld(&saved_mask);
+    
+    while ((next < end || nrunning > 0) && !stopped) {
+        int status = 0;
         
-        if (pids[i] == 0) {
+        /* Lance des lots tant qu'il reste des arguments et de la place */
+        while (next < end && nrunning < jobs) {
+            long room = fixed;
+            int first = next;
+            int spawn_status;
+            pid_t pid;
             
-            if (i > 0) {
-                dup2(pipefd[i-1][0], STDIN_FILENO);
-            }
+            do {
+                room -= exec_size(cmd->argv[next]);
+                next++;
+            } while (next < end && room - (long)exec_size(cmd->argv[next]) >= 0);
             
-            if (i < num_cmds - 1) {
-                dup2(pipefd[i][1], STDOUT_FILENO);
+            batch.argc = head + (next - first);
+            batch.argv = arena_alloc(&line_arena, sizeof(char *) * (batch.argc + 1));
+            if (batch.argv == NULL) {
+                next = end;
+                worst = 1;
+                break;
             }
+            memcpy(batch.argv, cmd->argv, sizeof(char *) * head);
+            memcpy(batch.argv + head, cmd->argv + first, sizeof(char *) * (next - first));
+            batch.argv[batch.argc] = NULL;
             
-            for (int j = 0; j < num_cmds - 1; j++) {
-                close(pipefd[j][0]);
-                close(pipefd[j][1]);
+            launch_pipeline(&batch, 1, -1, &pid, &spawn_status, NULL, NULL);
+            if (pid < 0) {
+                /* Commande introuvable : inutile de continuer */
+                worst = spawn_status > worst ? spawn_status : worst;
+                next = end;
+                break;
             }
             
-            if (setup_redirections(current) < 0) {
-                exit(1);
+            running[nrunning++] = pid;
+            shell_stats.batch_runs++;
+        }
+        
+        if (nrunning == 0) {
+            break;
+        }
+        
+        /* Attend le plus ancien lot encore en cours */
+        foreground_pid = running[0];
+        if (waitpid(running[0], &status, WUNTRACED) < 0) {
+            perror("waitpid");
+        }
+        foreground_pid = -1;
+        
+        if (WIFSTOPPED(status)) {
+            /* Les autres lots en cours s'arrêtent avec lui, dans le même job */
+            for (int i = 1; i < nrunning; i++) {
+                kill(running[i], SIGTSTP);
             }
-            
-            if (is_builtin(current->argv[0])) {
-                exit(execute_builtin(current));
+            add_stopped_job(running, nrunning, cmd->argv[0]);
+            if (next < end) {
+                fflush(stdout);
+                fprintf(stderr, "mysh: %d arguments non traités, lots suivants annulés\n",
+                        end - next);
             }
-            
-            execvp(current->argv[0], current->argv);
-            perror(current->argv[0]);
-            exit(127);
+            stopped = 1;
+            break;
         }
         
-        i++;
+        nrunning--;
+        memmove(running, running + 1, sizeof(pid_t) * nrunning);
+        if (WIFSIGNALED(status)) {
+            killed = 1;
+        } else if (WIFEXITED(status) && WEXITSTATUS(status) > worst) {
+            worst = WEXITSTATUS(status);
+        }
     }
     
-    for (i = 0; i < num_cmds - 1; i++) {
-        close(pipefd[i][0]);
-        close(pipefd[i][1]);
-    }
+    restore_sigmask(&saved_mask);
     
-    for (i = 0; i < num_cmds; i++) {
-        if (waitpid(pids[i], &status, 0) < 0) {
-            perror("waitpid");
-        }
+    if (stopped) {
+        return 0;
     }
     
-    if (WIFEXITED(status)) {
-        last_status = WEXITSTATUS(status);
-        return last_status;
+    last_status = killed ? -1 : worst;
+    return last_status;
+}
+
+/*
+ * Développe chaque étape du pipeline cmd juste avant de le lancer ; une
+ * étape dont il ne reste aucun mot est une erreur.
+ */
+static int expand_pipeline(command_t *cmd) {
+    for (command_t *current = cmd; current != NULL; current = current->next) {
+        if (expand_command(current) < 0) {
+            last_status = 1;
+            return -1;
+        }
+        if (current->argc == 0) {
+            fprintf(stderr, "mysh: commande vide après développement\n");
+            last_status = 1;
+            return -1;
+        }
     }
-    
     return 0;
 }
 
-int execute_command(command_t *cmd, cmd_type_t type, int background) {
+int execute_simple_command(command_t *cmd) {
     pid_t pid;
     int status;
+    int stopped;
+    sigset_t saved_mask;
     
-    if (cmd == NULL || cmd->argc == 0) {
+    /* Les mots sont développés maintenant, après les commandes qui précèdent */
+    if (expand_command(cmd) < 0) {
+        last_status = 1;
+        return 1;
+    }
+    if (cmd->argc == 0) {
         return 0;
     }
     
-    if (background) {
-        pid = fork();
-        if (pid < 0) {
-            perror("fork");
-            return -1;
-        }
+    /* Check builtin */
+    if (is_builtin(cmd->argv[0])) {
+        return run_builtin(cmd, -1);
+    }
+    
+    if (last_command != NULL) {
+        free(last_command);
+    }
+    last_command = strdup(cmd->argv[0]);
+    
+    if (needs_batching(cmd)) {
+        return execute_batched(cmd);
+    }
+    
+    /* Spawn and execute */
+    block_sigchld(&saved_mask);
+    launch_pipeline(cmd, 1, -1, &pid, &status, NULL, NULL);
+    if (pid < 0) {
+        restore_sigmask(&saved_mask);
+        last_status = status;
+        return status;
+    }
+    
+    /* processus parent */
+    status = wait_foreground(&pid, 1, cmd->argv[0], &stopped);
+    restore_sigmask(&saved_mask);
+    
+    if (stopped) {
+        return 0;
+    }
+    
+    return set_last_status(status);
+}
+
+int execute_pipeline(command_t *cmd) {
+    pid_t *pids;
+    command_t *current;
+    command_t *last = cmd;
+    int count = 0;
+    int status;
+    int spawn_status = 0;
+    int stopped;
+    sigset_t saved_mask;
+    relay_t *relays = NULL;
+    unsigned long long start;
+    
+    if (expand_pipeline(cmd) < 0) {
+        return last_status;
+    }
+    
+    for (current = cmd; current != NULL; current = current->next) {
+        last = current;
+        count++;
+    }
+    
+    pids = arena_alloc(&line_arena, sizeof(pid_t) * count);
+    if (pids == NULL) {
+        return 1;
+    }
+    
+    block_sigchld(&saved_mask);
+    
+    /* Un builtin en dernière étape tourne dans le shell, sur la sortie du tube */
+    if (count > 1 && is_builtin(last->argv[0])) {
+        int tail_fd = -1;
+        int builtin_status;
         
-        if (pid == 0) {
-            setpgid(0, 0); 
-            
-            if (type == CMD_PIPE) {
-                execute_pipeline(cmd);
-            } else {
-                execute_simple_command(cmd);
-            }
-            
-            exit(last_status);
+        launch_pipeline(cmd, count - 1, -1, pids, &spawn_status, &tail_fd, NULL);
+        builtin_status = run_builtin(last, tail_fd);
+        if (tail_fd >= 0) {
+            close(tail_fd);
         }
+        wait_foreground(pids, count - 1, cmd->argv[0], &stopped);
+        restore_sigmask(&saved_mask);
         
-        job_t *job = add_job(pid, cmd->argv[0]);
-        if (job != NULL) {
-            printf("[%d] %d\n", job->job_id, pid);
+        last_status = builtin_status;
+        return last_status;
+    }
+    
+    /* myopt pipestat : le shell relaie et mesure chaque tube */
+    if (shell_opts.pipe_stat) {
+        relays = arena_alloc(&line_arena, sizeof(relay_t) * (count - 1));
+        if (relays != NULL) {
+            memset(relays, 0, sizeof(relay_t) * (count - 1));
         }
-        
+    }
+    
+    start = now_ns();
+    launch_pipeline(cmd, count, -1, pids, &spawn_status, NULL, relays);
+    if (relays != NULL) {
+        run_relays(relays, count - 1, pids, count);
+    }
+    status = wait_foreground(pids, count, cmd->argv[0], &stopped);
+    restore_sigmask(&saved_mask);
+    
+    if (relays != NULL) {
+        print_relays(cmd, relays, count - 1, start);
+    }
+    
+    if (stopped) {
         return 0;
     }
     
-    switch (type) {
+    if (pids[count - 1] < 0) {
+        last_status = spawn_status;
+        return last_status;
+    }
+    
+    return set_last_status(status);
+}
+
+/*
+ * Lance une commande ou un pipeline en arrière-plan, directement : chaque
+ * processus est un fils du shell et le job possède leur groupe.
+ */
+static int execute_background(command_t *cmd, int count) {
+    pid_t *pids = arena_alloc(&line_arena, sizeof(pid_t) * count);
+    int spawn_status;
+    int n = 0;
+    
+    if (pids == NULL) {
+        return 1;
+    }
+    if (expand_pipeline(cmd) < 0) {
+        return last_status;
+    }
+    
+    launch_pipeline(cmd, count, 0, pids, &spawn_status, NULL, NULL);
+    
+    for (int i = 0; i < count; i++) {
+        if (pids[i] > 0) {
+            pids[n++] = pids[i];
+        }
+    }
+    if (n == 0) {
+        last_status = spawn_status;
+        return last_status;
+    }
+    
+    job_t *job = add_job(pids, n, pids[0], cmd->argv[0]);
+    if (job != NULL) {
+        printf("[%d] %d\n", job->job_id, job->pid);
+    }
+    
+    return 0;
+}
+
+/*
+ * Une chaîne && / || en arrière-plan doit être évaluée par un shell fils :
+ * il devient le chef du groupe du job et parcourt le sous-arbre.
+ */
+static int execute_background_subshell(node_t *node, char *name) {
+    pid_t pid = fork();
+    
+    if (pid < 0) {
+        perror("fork");
+        return -1;
+    }
+    
+    if (pid == 0) {
+        setpgid(0, 0);
+        exit(execute_command(node) == 0 ? 0 : (last_status < 0 ? 1 : last_status));
+    }
+    
+    setpgid(pid, pid);
+    
+    job_t *job = add_job(&pid, 1, pid, name);
+    if (job != NULL) {
+        printf("[%d] %d\n", job->job_id, job->pid);
+    }
+    
+    return 0;
+}
+
+/* Première commande d'un sous-arbre, sert de nom au job */
+static command_t *first_command(node_t *node) {
+    while (node->cmd == NULL) {
+        node = node->left;
+    }
+    return node->cmd;
+}
+
+/* Parcourt l'arbre de la ligne, renvoie le code de retour de la dernière commande */
+int execute_command(node_t *node) {
+    int status;
+    int count = 0;
+    
+    if (node == NULL) {
+        return 0;
+    }
+    
+    switch (node->type) {
         case CMD_SIMPLE:
-            return execute_simple_command(cmd);
+            return execute_simple_command(node->cmd);
             
         case CMD_PIPE:
-            return execute_pipeline(cmd);
+            return execute_pipeline(node->cmd);
             
         case CMD_SEQUENCE:
-            status = execute_simple_command(cmd);
-            if (cmd->next != NULL) {
-                return execute_command(cmd->next, CMD_SIMPLE, 0);
-            }
-            return status;
+            execute_command(node->left);
+            return execute_command(node->right);
             
         case CMD_AND:
-            status = execute_simple_command(cmd);
-            if (status == 0 && cmd->next != NULL) {
-                return execute_command(cmd->next, CMD_SIMPLE, 0);
+            status = execute_command(node->left);
+            if (status == 0) {
+                return execute_command(node->right);
             }
             return status;
             
         case CMD_OR:
-            status = execute_simple_command(cmd);
-            if (status != 0 && cmd->next != NULL) {
-                return execute_command(cmd->next, CMD_SIMPLE, 0);
+            status = execute_command(node->left);
+            if (status != 0) {
+                return execute_command(node->right);
             }
             return status;
             
+        case CMD_BACKGROUND:
+            if (node->left->cmd == NULL) {
+                return execute_background_subshell(node->left, first_command(node->left)->argv[0]);
+            }
+            if (node->left->cmd->argc == 0) {
+                return 0;
+            }
+            for (command_t *current = node->left->cmd; current != NULL; current = current->next) {
+                count++;
+            }
+            return execute_background(node->left->cmd, count);
+            
         default:
             return 0;
     }
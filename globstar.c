@@ -0,0 +1,378 @@
+#include "mysh.h"
+#include <sched.h>
+
+/*
+ * Parcours parallèle d'une arborescence pour le motif ** (voir wildcards.c).
+ * Chaque thread possède une file de répertoires à lire : il prend le plus
+ * récent dans la sienne et, quand elle est vide, vole le plus ancien dans
+ * celle d'un autre. Les entrées sont reconnues par d_type, un fstatat n'est
+ * fait que si le système de fichiers ne le fournit pas. Les liens
+ * symboliques ne sont pas suivis et les répertoires cachés ne sont pas
+ * parcourus, comme avec globstar dans bash. Chaque thread range ses
+ * résultats dans ses propres blocs ; ils sont réunis et triés à la fin.
+ */
+
+#define TREE_MAX_THREADS 64
+#define TREE_CHUNK_SIZE 65536
+
+/* Blocs de chaînes d'un thread */
+typedef struct string_chunk {
+    struct string_chunk *next;
+    size_t used;
+    size_t size;
+    char data[];
+} string_chunk_t;
+
+/* File d'un thread : le propriétaire prend en bas, les voleurs en haut */
+typedef struct {
+    pthread_mutex_t lock;
+    char **items;
+    size_t top;
+    size_t bottom;
+    size_t cap;
+} work_deque_t;
+
+typedef struct {
+    tree_walk_t *walk;
+    int id;
+    work_deque_t deque;
+    string_chunk_t *chunks;
+    char **results;
+    size_t count;
+    size_t cap;
+    unsigned long dirs;
+    int err;
+} tree_worker_t;
+
+typedef struct {
+    tree_walk_t *walk;
+    tree_worker_t *workers;
+    int nworkers;
+    atomic_long pending;        /* répertoires en file ou en cours de lecture */
+    atomic_int failed;
+} tree_state_t;
+
+static char *chunk_strdup(tree_worker_t *w, const char *a, size_t alen, const char *b, size_t blen, int slash) {
+    size_t need = alen + blen + slash + 1;
+    string_chunk_t *chunk = w->chunks;
+    char *s;
+    
+    if (chunk == NULL || chunk->size - chunk->used < need) {
+        size_t size = need > TREE_CHUNK_SIZE ? need : TREE_CHUNK_SIZE;
+        chunk = malloc(sizeof(string_chunk_t) + size);
+        if (chunk == NULL) {
+            return NULL;
+        }
+        chunk->size = size;
+        chunk->used = 0;
+        chunk->next = w->chunks;
+        w->chunks = chunk;
+    }
+    
+    s = chunk->data + chunk->used;
+    chunk->used += need;
+    memcpy(s, a, alen);
+    memcpy(s + alen, b, blen);
+    if (slash) {
+        s[alen + blen] = '/';
+    }
+    s[alen + blen + slash] = '\0';
+    return s;
+}
+
+static int add_result(tree_worker_t *w, char *path) {
+    if (w->count == w->cap) {
+        size_t cap = w->cap ? w->cap * 2 : 1024;
+        char **grown = realloc(w->results, sizeof(char *) * cap);
+        if (grown == NULL) {
+            return -1;
+        }
+        w->results = grown;
+        w->cap = cap;
+    }
+    w->results[w->count++] = path;
+    return 0;
+}
+
+static int deque_push(work_deque_t *dq, char *item) {
+    int ret = 0;
+    
+    pthread_mutex_lock(&dq->lock);
+    if (dq->bottom == dq->cap) {
+        /* Tasse la file avant de l'agrandir */
+        size_t n = dq->bottom - dq->top;
+        if (dq->top > 0) {
+            memmove(dq->items, dq->items + dq->top, sizeof(char *) * n);
+            dq->top = 0;
+            dq->bottom = n;
+        }
+        if (dq->bottom == dq->cap) {
+            size_t cap = dq->cap ? dq->cap * 2 : 256;
+            char **grown = realloc(dq->items, sizeof(char *) * cap);
+            if (grown == NULL) {
+                ret = -1;
+            } else {
+                dq->items = grown;
+                dq->cap = cap;
+            }
+        }
+    }
+    if (ret == 0) {
+        dq->items[dq->bottom++] = item;
+    }
+    pthread_mutex_unlock(&dq->lock);
+    return ret;
+}
+
+static char *deque_pop(work_deque_t *dq) {
+    char *item = NULL;
+    
+    pthread_mutex_lock(&dq->lock);
+    if (dq->bottom > dq->top) {
+        item = dq->items[--dq->bottom];
+    }
+    pthread_mutex_unlock(&dq->lock);
+    return item;
+}
+
+static char *deque_steal(work_deque_t *dq) {
+    char *item = NULL;
+    
+    pthread_mutex_lock(&dq->lock);
+    if (dq->bottom > dq->top) {
+        item = dq->items[dq->top++];
+    }
+    pthread_mutex_unlock(&dq->lock);
+    return item;
+}
+
+/* Lit le répertoire rel (relatif à la racine, terminé par '/' ou vide) */
+static void scan_directory(tree_state_t *st, tree_worker_t *w, const char *rel) {
+    tree_walk_t *walk = st->walk;
+    size_t root_len = strlen(walk->root);
+    size_t rel_len = strlen(rel);
+    char *full = malloc(root_len + rel_len + 2);
+    struct dirent *entry;
+    DIR *dir;
+    int fd;
+    
+    if (full == NULL) {
+        w->err = -1;
+        return;
+    }
+    memcpy(full, walk->root, root_len);
+    memcpy(full + root_len, rel, rel_len + 1);
+    if (full[0] == '\0') {
+        strcpy(full, ".");
+    }
+    
+    dir = opendir(full);
+    free(full);
+    if (dir == NULL) {
+        return;
+    }
+    fd = dirfd(dir);
+    w->dirs++;
+    
+    if (walk->match == NULL && add_result(w, (char *)rel) < 0) {
+        w->err = -1;
+    }
+    
+    while (!w->err && (entry = readdir(dir)) != NULL) {
+        const char *name = entry->d_name;
+        size_t len = strlen(name);
+        unsigned char type = entry->d_type;
+        int is_dir;
+        
+        if (name[0] == '.' && (len == 1 || (len == 2 && name[1] == '.'))) {
+            continue;
+        }
+        
+        if (type == DT_UNKNOWN) {
+            struct stat sb;
+            if (fstatat(fd, name, &sb, AT_SYMLINK_NOFOLLOW) == 0) {
+                type = S_ISDIR(sb.st_mode) ? DT_DIR : S_ISLNK(sb.st_mode) ? DT_LNK : DT_REG;
+            }
+        }
+        is_dir = (type == DT_DIR);
+        
+        if (walk->match != NULL && walk->match(walk->pattern, name, len)) {
+            int keep = 1;
+            if (walk->dirs_only && !is_dir) {
+                /* Un lien vers un répertoire convient pour un motif terminé par '/' */
+                struct stat sb;
+                keep = (type == DT_LNK && fstatat(fd, name, &sb, 0) == 0 && S_ISDIR(sb.st_mode));
+            }
+            if (keep) {
+                char *path = chunk_strdup(w, rel, rel_len, name, len, 0);
+                if (path == NULL || add_result(w, path) < 0) {
+                    w->err = -1;
+                }
+            }
+        }
+        
+        if (is_dir && name[0] != '.') {
+            char *sub = chunk_strdup(w, rel, rel_len, name, len, 1);
+            atomic_fetch_add(&st->pending, 1);
+            if (sub == NULL || deque_push(&w->deque, sub) < 0) {
+                atomic_fetch_sub(&st->pending, 1);
+                w->err = -1;
+            }
+        }
+    }
+    
+    closedir(dir);
+}
+
+static void *tree_worker(void *arg) {
+    tree_worker_t *w = arg;
+    tree_state_t *st = (tree_state_t *)w->walk->state;
+    
+    while (1) {
+        char *rel = deque_pop(&w->deque);
+        
+        /* File vide : vol chez les autres, en commençant par le voisin */
+        for (int k = 1; rel == NULL && k < st->nworkers; k++) {
+            rel = deque_steal(&st->workers[(w->id + k) % st->nworkers].deque);
+        }
+        
+        if (rel == NULL) {
+            if (atomic_load(&st->pending) == 0 || atomic_load(&st->failed)) {
+                break;
+            }
+            sched_yield();
+            continue;
+        }
+        
+        if (!atomic_load(&st->failed)) {
+            scan_directory(st, w, rel);
+            if (w->err) {
+                atomic_store(&st->failed, 1);
+            }
+        }
+        atomic_fetch_sub(&st->pending, 1);
+    }
+    
+    return NULL;
+}
+
+static int compare_strings(const void *a, const void *b) {
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+/* Nombre de threads : l'option globthreads, sinon un par processeur */
+static int walk_threads(void) {
+    long n = shell_opts.glob_threads;
+    
+    if (n <= 0) {
+        n = sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if (n < 1) {
+        n = 1;
+    }
+    return n > TREE_MAX_THREADS ? TREE_MAX_THREADS : n;
+}
+
+/*
+ * Parcourt l'arborescence sous walk->root. Avec walk->match, renvoie les
+ * chemins (relatifs à root) des entrées qui correspondent ; sans, ceux de
+ * tous les répertoires, root compris ("") et terminés par '/'. Les résultats
+ * sont triés ; ils restent valables jusqu'à tree_walk_free().
+ */
+int tree_walk(tree_walk_t *walk) {
+    tree_state_t st;
+    pthread_t threads[TREE_MAX_THREADS];
+    int started = 0;
+    int err = 0;
+    size_t total = 0;
+    
+    memset(&st, 0, sizeof(st));
+    st.walk = walk;
+    st.nworkers = walk_threads();
+    st.workers = calloc(st.nworkers, sizeof(tree_worker_t));
+    if (st.workers == NULL) {
+        return -1;
+    }
+    atomic_init(&st.pending, 1);
+    atomic_init(&st.failed, 0);
+    walk->state = &st;
+    walk->results = NULL;
+    walk->count = 0;
+    walk->dirs = 0;
+    walk->chunks = NULL;
+    
+    for (int i = 0; i < st.nworkers; i++) {
+        st.workers[i].walk = walk;
+        st.workers[i].id = i;
+        pthread_mutex_init(&st.workers[i].deque.lock, NULL);
+    }
+    deque_push(&st.workers[0].deque, "");
+    
+    /* Le thread appelant sert de premier ouvrier */
+    for (int i = 1; i < st.nworkers; i++) {
+        if (pthread_create(&threads[i], NULL, tree_worker, &st.workers[i]) != 0) {
+            break;
+        }
+        started = i;
+    }
+    tree_worker(&st.workers[0]);
+    for (int i = 1; i <= started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    
+    for (int i = 0; i < st.nworkers; i++) {
+        total += st.workers[i].count;
+        err |= st.workers[i].err;
+        walk->dirs += st.workers[i].dirs;
+    }
+    
+    walk->results = malloc(sizeof(char *) * (total ? total : 1));
+    if (walk->results == NULL) {
+        err = -1;
+    }
+    
+    for (int i = 0; i < st.nworkers; i++) {
+        tree_worker_t *w = &st.workers[i];
+        
+        if (walk->results != NULL) {
+            memcpy(walk->results + walk->count, w->results, sizeof(char *) * w->count);
+            walk->count += w->count;
+        }
+        free(w->results);
+        free(w->deque.items);
+        pthread_mutex_destroy(&w->deque.lock);
+        
+        /* Les blocs de chaînes passent au parcours, libérés par tree_walk_free */
+        while (w->chunks != NULL) {
+            string_chunk_t *next = w->chunks->next;
+            w->chunks->next = walk->chunks;
+            walk->chunks = w->chunks;
+            w->chunks = next;
+        }
+    }
+    free(st.workers);
+    walk->state = NULL;
+    walk->threads = st.nworkers;
+    
+    if (err) {
+        tree_walk_free(walk);
+        return -1;
+    }
+    
+    qsort(walk->results, walk->count, sizeof(char *), compare_strings);
+    return 0;
+}
+
+void tree_walk_free(tree_walk_t *walk) {
+    string_chunk_t *chunk = walk->chunks;
+    
+    while (chunk != NULL) {
+        string_chunk_t *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    walk->chunks = NULL;
+    free(walk->results);
+    walk->results = NULL;
+    walk->count = 0;
+}
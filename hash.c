@@ -0,0 +1,313 @@
+#include "mysh.h"
+
+/*
+ * Table des emplacements de commandes (builtin hash).
+ * argv[0] est résolu une fois dans $PATH puis lancé par son chemin absolu ;
+ * les noms introuvables sont gardés aussi (path == NULL) pour ne pas refaire
+ * la recherche, tant qu'aucun répertoire de PATH n'a été modifié depuis
+ * (une commande installée change la date du répertoire). La table est vidée
+ * quand PATH change, y compris par setenv dans un autre shell : après chaque
+ * écriture dans l'environnement partagé (env_changes), PATH est relu et
+ * comparé à celui de la table.
+ */
+
+#define HASH_INITIAL_BUCKETS 64
+
+typedef struct hash_entry {
+    char *name;
+    char *path;
+    unsigned int hits;
+    struct timespec dirs_mtime;     /* path == NULL : date des répertoires de PATH */
+    struct hash_entry *next;
+} hash_entry_t;
+
+static hash_entry_t **buckets = NULL;
+static unsigned int bucket_count = 0;
+static unsigned int entry_count = 0;
+static unsigned int hashed_changes = 0;
+static char *hashed_path = NULL;
+static int path_recorded = 0;
+
+static unsigned int hash_name(const char *name) {
+    unsigned int h = 2166136261u;
+    
+    while (*name) {
+        h ^= (unsigned char)*name++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static void grow_table(void) {
+    unsigned int new_count = bucket_count ? bucket_count * 2 : HASH_INITIAL_BUCKETS;
+    hash_entry_t **new_buckets = calloc(new_count, sizeof(hash_entry_t *));
+    
+    if (new_buckets == NULL) {
+        return;
+    }
+    
+    for (unsigned int i = 0; i < bucket_count; i++) {
+        hash_entry_t *entry = buckets[i];
+        while (entry != NULL) {
+            hash_entry_t *next = entry->next;
+            unsigned int b = hash_name(entry->name) & (new_count - 1);
+            entry->next = new_buckets[b];
+            new_buckets[b] = entry;
+            entry = next;
+        }
+    }
+    
+    free(buckets);
+    buckets = new_buckets;
+    bucket_count = new_count;
+}
+
+static hash_entry_t **find_slot(const char *name) {
+    hash_entry_t **slot;
+    
+    if (bucket_count == 0) {
+        return NULL;
+    }
+    
+    slot = &buckets[hash_name(name) & (bucket_count - 1)];
+    while (*slot != NULL && strcmp((*slot)->name, name) != 0) {
+        slot = &(*slot)->next;
+    }
+    return slot;
+}
+
+/* Parcourt $PATH comme execvp, renvoie un chemin alloué ou NULL */
+static char *search_path(const char *name) {
+    char *dirs = dup_variable("PATH");
+    char *dir;
+    char *saveptr;
+    char *found = NULL;
+    struct stat st;
+    
+    if (dirs == NULL) {
+        dirs = strdup("/bin:/usr/bin");
+        if (dirs == NULL) {
+            return NULL;
+        }
+    }
+    
+    for (dir = strtok_r(dirs, ":", &saveptr); dir != NULL; dir = strtok_r(NULL, ":", &saveptr)) {
+        size_t len = strlen(dir) + strlen(name) + 2;
+        char *candidate = malloc(len);
+        if (candidate == NULL) {
+            break;
+        }
+        snprintf(candidate, len, "%s/%s", *dir ? dir : ".", name);
+        
+        if (stat(candidate, &st) == 0 && S_ISREG(st.st_mode) && access(candidate, X_OK) == 0) {
+            found = candidate;
+            break;
+        }
+        free(candidate);
+    }
+    
+    free(dirs);
+    return found;
+}
+
+/* Date de modification la plus récente des répertoires de PATH */
+static struct timespec path_dirs_mtime(void) {
+    struct timespec latest = { 0, 0 };
+    char *dirs = dup_variable("PATH");
+    char *dir;
+    char *saveptr;
+    struct stat st;
+    
+    if (dirs == NULL) {
+        dirs = strdup("/bin:/usr/bin");
+        if (dirs == NULL) {
+            return latest;
+        }
+    }
+    
+    for (dir = strtok_r(dirs, ":", &saveptr); dir != NULL; dir = strtok_r(NULL, ":", &saveptr)) {
+        if (stat(*dir ? dir : ".", &st) == 0 &&
+            (st.st_mtim.tv_sec > latest.tv_sec ||
+             (st.st_mtim.tv_sec == latest.tv_sec && st.st_mtim.tv_nsec > latest.tv_nsec))) {
+            latest = st.st_mtim;
+        }
+    }
+    
+    free(dirs);
+    return latest;
+}
+
+static hash_entry_t *resolve(const char *name) {
+    hash_entry_t **slot;
+    hash_entry_t *entry;
+    
+    if (entry_count >= bucket_count) {
+        grow_table();
+    }
+    
+    slot = find_slot(name);
+    if (slot == NULL) {
+        return NULL;
+    }
+    
+    entry = *slot;
+    if (entry == NULL) {
+        entry = malloc(sizeof(hash_entry_t));
+        if (entry == NULL) {
+            return NULL;
+        }
+        entry->name = strdup(name);
+        if (entry->name == NULL) {
+            free(entry);
+            return NULL;
+        }
+        entry->hits = 0;
+        entry->next = NULL;
+        *slot = entry;
+        entry_count++;
+    } else {
+        free(entry->path);
+    }
+    
+    /* La date est prise avant la recherche : un ajout pendant celle-ci
+     * sera vu à la prochaine */
+    entry->dirs_mtime = path_dirs_mtime();
+    entry->path = search_path(name);
+    return entry;
+}
+
+/* Vide la table si PATH a changé depuis la dernière écriture vue */
+static void check_path(void) {
+    unsigned int changes = env_changes();
+    char *path;
+    
+    /* Premier appel : PATH est noté, sans rien vider */
+    if (!path_recorded) {
+        hashed_changes = changes;
+        hashed_path = dup_variable("PATH");
+        path_recorded = 1;
+        return;
+    }
+    if (changes == hashed_changes) {
+        return;
+    }
+    hashed_changes = changes;
+    
+    path = dup_variable("PATH");
+    if (path == NULL ? hashed_path == NULL : (hashed_path != NULL && strcmp(path, hashed_path) == 0)) {
+        free(path);
+        return;
+    }
+    clear_command_hash();
+    free(hashed_path);
+    hashed_path = path;
+}
+
+/*
+ * Chemin à passer à execve pour name. Un nom contenant '/' est utilisé tel
+ * quel ; NULL signifie que la commande est introuvable (errno = ENOENT).
+ */
+char *find_command(char *name) {
+    hash_entry_t **slot;
+    hash_entry_t *entry;
+    
+    if (strchr(name, '/') != NULL) {
+        return name;
+    }
+    
+    check_path();
+    slot = find_slot(name);
+    entry = (slot != NULL) ? *slot : NULL;
+    if (entry != NULL && entry->path == NULL) {
+        /* Échec mémorisé : refait si un répertoire de PATH a changé */
+        struct timespec now = path_dirs_mtime();
+        if (now.tv_sec != entry->dirs_mtime.tv_sec || now.tv_nsec != entry->dirs_mtime.tv_nsec) {
+            entry = NULL;
+        }
+    }
+    if (entry == NULL) {
+        entry = resolve(name);
+    }
+    
+    if (entry == NULL || entry->path == NULL) {
+        errno = ENOENT;
+        return NULL;
+    }
+    
+    entry->hits++;
+    return entry->path;
+}
+
+/* Oublie name (chemin mémorisé qui n'existe plus) */
+void forget_command(char *name) {
+    hash_entry_t **slot = find_slot(name);
+    hash_entry_t *entry;
+    
+    if (slot == NULL || *slot == NULL) {
+        return;
+    }
+    
+    entry = *slot;
+    *slot = entry->next;
+    free(entry->name);
+    free(entry->path);
+    free(entry);
+    entry_count--;
+}
+
+void clear_command_hash(void) {
+    for (unsigned int i = 0; i < bucket_count; i++) {
+        hash_entry_t *entry = buckets[i];
+        while (entry != NULL) {
+            hash_entry_t *next = entry->next;
+            free(entry->name);
+            free(entry->path);
+            free(entry);
+            entry = next;
+        }
+        buckets[i] = NULL;
+    }
+    entry_count = 0;
+}
+
+int builtin_hash(char **argv) {
+    int ret = 0;
+    
+    if (argv[1] == NULL) {
+        check_path();
+        if (entry_count == 0) {
+            printf("hash: table vide\n");
+            return 0;
+        }
+        printf("hits\tcommande\n");
+        for (unsigned int i = 0; i < bucket_count; i++) {
+            for (hash_entry_t *entry = buckets[i]; entry != NULL; entry = entry->next) {
+                if (entry->path != NULL) {
+                    printf("%4u\t%s\n", entry->hits, entry->path);
+                } else {
+                    printf("   -\t%s (introuvable)\n", entry->name);
+                }
+            }
+        }
+        return 0;
+    }
+    
+    if (strcmp(argv[1], "-r") == 0) {
+        clear_command_hash();
+        return 0;
+    }
+    
+    /* hash nom... : force une nouvelle recherche */
+    for (int i = 1; argv[i] != NULL; i++) {
+        if (is_builtin(argv[i]) || strchr(argv[i], '/') != NULL) {
+            continue;
+        }
+        hash_entry_t *entry = resolve(argv[i]);
+        if (entry == NULL || entry->path == NULL) {
+            fprintf(stderr, "hash: %s: not found\n", argv[i]);
+            ret = 1;
+        }
+    }
+    
+    return ret;
+}
@@ -1,111 +1,388 @@
 #include "mysh.h"
 
-job_t *add_job(pid_t pid, char *command) {
-    job_t *job = malloc(sizeof(job_t));
+/*
+ * Table des jobs : slots[] est indexé par numéro de job et pids[] est une
+ * table de hachage (adressage ouvert) pid -> job. Les deux grandissent à la
+ * demande, toutes les opérations courantes sont en O(1).
+ */
+
+#define JOB_INITIAL_SLOTS 16
+#define PID_INITIAL_SLOTS 32
+#define JOB_EVENT_RING 1024
+
+/* Statuts récoltés par sigchld_handler, consommés par check_background_jobs */
+typedef struct {
+    pid_t pid;
+    int status;
+} job_event_t;
+
+static job_event_t event_ring[JOB_EVENT_RING];
+static atomic_uint event_head;
+static atomic_uint event_tail;
+static volatile sig_atomic_t event_overflow = 0;
+
+static unsigned int pid_hash(pid_t pid) {
+    return (unsigned int)pid * 2654435761u;
+}
+
+static int pid_insert(pid_t pid, job_t *job);
+
+static int grow_pid_table(void) {
+    unsigned int old_capacity = job_table.pid_capacity;
+    pid_slot_t *old_slots = job_table.pids;
+    unsigned int new_capacity = old_capacity ? old_capacity * 2 : PID_INITIAL_SLOTS;
+    pid_slot_t *new_slots = calloc(new_capacity, sizeof(pid_slot_t));
+    
+    if (new_slots == NULL) {
+        perror("calloc");
+        return -1;
+    }
+    
+    job_table.pids = new_slots;
+    job_table.pid_capacity = new_capacity;
+    job_table.pid_count = 0;
+    
+    for (unsigned int i = 0; i < old_capacity; i++) {
+        if (old_slots[i].pid > 0) {
+            pid_insert(old_slots[i].pid, old_slots[i].job);
+        }
+    }
+    
+    free(old_slots);
+    return 0;
+}
+
+static int pid_insert(pid_t pid, job_t *job) {
+    unsigned int mask;
+    unsigned int i;
+    
+    /* Facteur de charge maximal 1/2 */
+    if ((job_table.pid_count + 1) * 2 > job_table.pid_capacity && grow_pid_table() < 0) {
+        return -1;
+    }
+    
+    mask = job_table.pid_capacity - 1;
+    i = pid_hash(pid) & mask;
+    while (job_table.pids[i].pid > 0 && job_table.pids[i].pid != pid) {
+        i = (i + 1) & mask;
+    }
+    
+    if (job_table.pids[i].pid == 0) {
+        job_table.pid_count++;
+    }
+    job_table.pids[i].pid = pid;
+    job_table.pids[i].job = job;
+    return 0;
+}
+
+static void pid_remove(pid_t pid) {
+    unsigned int mask;
+    unsigned int i;
+    unsigned int j;
+    
+    if (job_table.pid_capacity == 0) {
+        return;
+    }
+    
+    mask = job_table.pid_capacity - 1;
+    i = pid_hash(pid) & mask;
+    while (job_table.pids[i].pid != pid) {
+        if (job_table.pids[i].pid == 0) {
+            return;
+        }
+        i = (i + 1) & mask;
+    }
+    
+    /* Suppression par décalage arrière : pas de pierre tombale */
+    j = i;
+    while (1) {
+        unsigned int home;
+        
+        job_table.pids[i].pid = 0;
+        job_table.pids[i].job = NULL;
+        
+        do {
+            j = (j + 1) & mask;
+            if (job_table.pids[j].pid == 0) {
+                job_table.pid_count--;
+                return;
+            }
+            home = pid_hash(job_table.pids[j].pid) & mask;
+        } while (i <= j ? (i < home && home <= j) : (i < home || home <= j));
+        
+        job_table.pids[i] = job_table.pids[j];
+        i = j;
+    }
+}
+
+job_t *add_job(pid_t *pids, int npids, pid_t pgid, char *command) {
+    int job_id = job_table.highest + 1;
+    job_t *job;
+    
+    if (job_id >= job_table.capacity) {
+        int new_capacity = job_table.capacity ? job_table.capacity * 2 : JOB_INITIAL_SLOTS;
+        job_t **new_slots = realloc(job_table.slots, sizeof(job_t *) * new_capacity);
+        if (new_slots == NULL) {
+            perror("realloc");
+            return NULL;
+        }
+        memset(new_slots + job_table.capacity, 0,
+               sizeof(job_t *) * (new_capacity - job_table.capacity));
+        job_table.slots = new_slots;
+        job_table.capacity = new_capacity;
+    }
+    
+    job = malloc(sizeof(job_t));
     if (job == NULL) {
         perror("malloc");
         return NULL;
     }
     
-    job->job_id = ++job_counter;
-    job->pid = pid;
+    job->pids = malloc(sizeof(pid_t) * npids);
+    if (job->pids == NULL) {
+        perror("malloc");
+        free(job);
+        return NULL;
+    }
+    memcpy(job->pids, pids, sizeof(pid_t) * npids);
+    
+    job->job_id = job_id;
+    job->pid = pids[npids - 1];
+    job->pgid = pgid;
+    job->npids = npids;
+    job->nalive = npids;
     job->command = strdup(command);
     job->state = JOB_RUNNING;
     job->status = 0;
-    job->next = job_list;
-    job_list = job;
+    
+    for (int i = 0; i < npids; i++) {
+        if (pid_insert(pids[i], job) < 0) {
+            while (--i >= 0) {
+                pid_remove(pids[i]);
+            }
+            free(job->command);
+            free(job->pids);
+            free(job);
+            return NULL;
+        }
+    }
+    
+    job_table.slots[job_id] = job;
+    job_table.highest = job_id;
+    job_table.count++;
     
     return job;
 }
 
 void remove_job(int job_id) {
-    job_t *prev = NULL;
-    job_t *current = job_list;
-    
-    while (current != NULL) {
-        if (current->job_id == job_id) {
-            if (prev == NULL) {
-                job_list = current->next;
-            } else {
-                prev->next = current->next;
-            }
-            
-            free(current->command);
-            free(current);
-            
-            if (job_list == NULL) {
-                job_counter = 0;
-            }
-            
-            return;
+    job_t *job = get_job_by_id(job_id);
+    
+    if (job == NULL) {
+        return;
+    }
+    
+    for (int i = 0; i < job->npids; i++) {
+        if (get_job_by_pid(job->pids[i]) == job) {
+            pid_remove(job->pids[i]);
         }
-        prev = current;
-        current = current->next;
     }
+    job_table.slots[job_id] = NULL;
+    job_table.count--;
+    
+    /* Le prochain job reprend après le plus grand numéro encore utilisé */
+    while (job_table.highest > 0 && job_table.slots[job_table.highest] == NULL) {
+        job_table.highest--;
+    }
+    
+    free(job->command);
+    free(job->pids);
+    free(job);
 }
 
 job_t *get_job_by_id(int job_id) {
-    job_t *current = job_list;
+    if (job_id <= 0 || job_id > job_table.highest) {
+        return NULL;
+    }
+    
+    return job_table.slots[job_id];
+}
+
+job_t *get_job_by_pid(pid_t pid) {
+    unsigned int mask;
+    unsigned int i;
+    
+    if (job_table.pid_capacity == 0 || pid <= 0) {
+        return NULL;
+    }
     
-    while (current != NULL) {
-        if (current->job_id == job_id) {
-            return current;
+    mask = job_table.pid_capacity - 1;
+    i = pid_hash(pid) & mask;
+    while (job_table.pids[i].pid != 0) {
+        if (job_table.pids[i].pid == pid) {
+            return job_table.pids[i].job;
         }
-        current = current->next;
+        i = (i + 1) & mask;
     }
     
     return NULL;
 }
 
-job_t *get_job_by_pid(pid_t pid) {
-    job_t *current = job_list;
+/* Place libre dans l'anneau ; appelable depuis un gestionnaire de signal */
+int job_event_room(void) {
+    unsigned int head = atomic_load_explicit(&event_head, memory_order_relaxed);
+    unsigned int tail = atomic_load_explicit(&event_tail, memory_order_acquire);
+    
+    if (head - tail >= JOB_EVENT_RING) {
+        event_overflow = 1;
+        return 0;
+    }
+    return 1;
+}
+
+/* Producteur unique : sigchld_handler */
+void job_event_push(pid_t pid, int status) {
+    unsigned int head = atomic_load_explicit(&event_head, memory_order_relaxed);
+    
+    event_ring[head & (JOB_EVENT_RING - 1)].pid = pid;
+    event_ring[head & (JOB_EVENT_RING - 1)].status = status;
+    atomic_store_explicit(&event_head, head + 1, memory_order_release);
+}
+
+static int job_event_pop(job_event_t *event) {
+    unsigned int tail = atomic_load_explicit(&event_tail, memory_order_relaxed);
+    unsigned int head = atomic_load_explicit(&event_head, memory_order_acquire);
+    
+    if (tail == head) {
+        return 0;
+    }
+    
+    *event = event_ring[tail & (JOB_EVENT_RING - 1)];
+    atomic_store_explicit(&event_tail, tail + 1, memory_order_release);
+    return 1;
+}
+
+/*
+ * Enregistre le statut d'un processus du job. Renvoie 1 quand le dernier
+ * processus vivant du job vient de se terminer.
+ */
+static int job_process_status(job_t *job, pid_t pid, int status) {
+    if (WIFSTOPPED(status)) {
+        job->state = JOB_STOPPED;
+        return 0;
+    }
+    
+    if (pid == job->pid) {
+        job->status = status;
+    }
+    pid_remove(pid);
+    job->nalive--;
+    
+    return job->nalive == 0;
+}
+
+/* Met à jour le job de pid, renvoie 1 si une fin de job a été affichée */
+static int update_job(pid_t pid, int status, int at_prompt) {
+    job_t *job = get_job_by_pid(pid);
+    
+    if (job == NULL || !job_process_status(job, pid, status)) {
+        return 0;
+    }
+    
+    /* À l'invite, la notification commence sur une nouvelle ligne */
+    if (at_prompt) {
+        printf("\n");
+    }
+    
+    if (WIFEXITED(job->status)) {
+        printf("%s (jobs=[%d], pid=%d) terminée avec status=%d\n",
+               job->command, job->job_id, job->pid, WEXITSTATUS(job->status));
+    } else {
+        printf("%s (jobs=[%d], pid=%d) terminée avec status=-1\n",
+               job->command, job->job_id, job->pid);
+    }
+    remove_job(job->job_id);
+    
+    return 1;
+}
+
+/* Envoie sig au groupe du job, ou à chacun de ses processus vivants */
+void signal_job(job_t *job, int sig) {
+    if (job->pgid > 0) {
+        kill(-job->pgid, sig);
+        return;
+    }
     
-    while (current != NULL) {
-        if (current->pid == pid) {
-            return current;
+    for (int i = 0; i < job->npids; i++) {
+        if (get_job_by_pid(job->pids[i]) == job) {
+            kill(job->pids[i], sig);
         }
-        current = current->next;
     }
+}
+
+/*
+ * Attend les processus vivants du job (SIGCHLD bloqué). Renvoie le statut
+ * du dernier processus et retire le job, ou -1 si le job est de nouveau stoppé.
+ */
+int wait_job(job_t *job) {
+    int status;
     
-    return NULL;
+    for (int i = 0; i < job->npids && job->nalive > 0; i++) {
+        pid_t pid = job->pids[i];
+        
+        while (get_job_by_pid(pid) == job) {
+            if (waitpid(pid, &status, WUNTRACED) < 0) {
+                perror("waitpid");
+                pid_remove(pid);
+                job->nalive--;
+                break;
+            }
+            
+            job_process_status(job, pid, status);
+            if (WIFSTOPPED(status)) {
+                return -1;
+            }
+        }
+    }
+    
+    status = job->status;
+    remove_job(job->job_id);
+    return status;
 }
 
+/* Vide l'anneau des statuts récoltés : aucun appel système par job */
 void check_background_jobs(void) {
-    job_t *current = job_list;
-    job_t *next;
+    job_event_t event;
+    sigset_t saved_mask;
     pid_t pid;
     int status;
     
-    while (current != NULL) {
-        next = current->next;
-        
-        pid = waitpid(current->pid, &status, WNOHANG | WUNTRACED);
-        
-        if (pid > 0) {
-            if (WIFEXITED(status)) {
-                printf("%s (jobs=[%d], pid=%d) terminée avec status=%d\n",
-                       current->command, current->job_id, current->pid,
-                       WEXITSTATUS(status));
-                remove_job(current->job_id);
-            } else if (WIFSIGNALED(status)) {
-                printf("%s (jobs=[%d], pid=%d) terminée avec status=-1\n",
-                       current->command, current->job_id, current->pid);
-                remove_job(current->job_id);
-            } else if (WIFSTOPPED(status)) {
-                current->state = JOB_STOPPED;
-            }
+    while (job_event_pop(&event)) {
+        update_job(event.pid, event.status, 0);
+    }
+    
+    /* L'anneau était plein : les fils restants n'ont pas été récoltés */
+    if (event_overflow) {
+        block_sigchld(&saved_mask);
+        event_overflow = 0;
+        while (job_event_pop(&event)) {
+            update_job(event.pid, event.status, 0);
         }
-        
-        current = next;
+        while ((pid = waitpid(-1, &status, WNOHANG | WUNTRACED)) > 0) {
+            update_job(pid, status, 0);
+        }
+        restore_sigmask(&saved_mask);
     }
 }
 
 void print_jobs(void) {
-    job_t *current = job_list;
-    
-    while (current != NULL) {
+    for (int id = 1; id <= job_table.highest; id++) {
+        job_t *current = job_table.slots[id];
         char *state_str;
         
+        if (current == NULL) {
+            continue;
+        }
+        
         switch (current->state) {
             case JOB_RUNNING:
                 state_str = "En cours d'exécution";
@@ -118,23 +395,24 @@ void print_jobs(void) {
                 break;
         }
         
-        printf("[%d] %d %s %s\n", current->job_id, current->pid, 
+        printf("[%d] %d %s %s\n", current->job_id, current->pid,
                state_str, current->command);
-        
-        current = current->next;
     }
 }
 
 int get_highest_job_id(void) {
-    job_t *current = job_list;
-    int highest = -1;
+    return (job_table.highest > 0) ? job_table.highest : -1;
+}
+
+/* Récolte les fils terminés signalés par signal_fd : un waitpid par événement */
+int reap_children(int at_prompt) {
+    pid_t pid;
+    int status;
+    int notified = 0;
     
-    while (current != NULL) {
-        if (current->job_id > highest) {
-            highest = current->job_id;
-        }
-        current = current->next;
+    while ((pid = waitpid(-1, &status, WNOHANG | WUNTRACED)) > 0) {
+        notified += update_job(pid, status, at_prompt && notified == 0);
     }
     
-    return highest;
+    return notified;
 }
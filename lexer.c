@@ -0,0 +1,265 @@
+#include "mysh.h"
+
+/*
+ * Analyseur lexical d'une ligne, en une seule passe.
+ * Chaque octet est classé par une table : les octets ordinaires d'un mot sont
+ * recopiés sans autre test, les autres (blancs, opérateurs, guillemets, '\')
+ * arrêtent la boucle rapide. Les mots sont écrits, guillemets retirés, dans un
+ * tampon pris dans line_arena ; un mot qui avait des guillemets ou des '\'
+ * y garde aussi son texte d'origine, que l'exécution développera (voir
+ * expand_word()). Tout l'état est dans le lexer_t, il n'y a aucune donnée
+ * statique.
+ */
+
+#define CC_WORD     0x00
+#define CC_SPACE    0x01
+#define CC_OPERATOR 0x02
+#define CC_QUOTE    0x04
+#define CC_ESCAPE   0x08
+#define CC_END      0x10
+
+static const unsigned char char_class[256] = {
+    ['\0'] = CC_END,
+    [' '] = CC_SPACE,
+    ['\t'] = CC_SPACE,
+    ['\n'] = CC_SPACE,
+    ['|'] = CC_OPERATOR,
+    ['&'] = CC_OPERATOR,
+    [';'] = CC_OPERATOR,
+    ['<'] = CC_OPERATOR,
+    ['>'] = CC_OPERATOR,
+    ['\''] = CC_QUOTE,
+    ['"'] = CC_QUOTE,
+    ['\\'] = CC_ESCAPE,
+};
+
+#define CLASS(c) (char_class[(unsigned char)(c)])
+
+int lexer_init(lexer_t *lx, const char *line) {
+    size_t len = strlen(line);
+    
+    lx->pos = line;
+    /* Chaque octet donne au plus un octet de mot, plus un '\0' par mot,
+     * deux fois pour les mots qui gardent leur texte d'origine */
+    lx->out = arena_alloc(&line_arena, 4 * len + 1);
+    return lx->out != NULL ? 0 : -1;
+}
+
+static void set_token(token_t *tok, token_type_t type, redir_type_t redir, const char *text) {
+    tok->type = type;
+    tok->redir = redir;
+    tok->text = text;
+    tok->raw = text;
+    tok->fd = -1;
+    tok->source = -1;
+    tok->quoted = 0;
+}
+
+/*
+ * Suite de N>& ou N<& en p : un numéro de descripteur ou '-' formant tout
+ * le mot. Renvoie la longueur lue, 0 si ce n'est ni l'un ni l'autre.
+ */
+static int lex_dup_source(const char *p, token_t *tok) {
+    int n = 0;
+    int source = 0;
+    
+    if (p[0] == '-' && CLASS(p[1]) != CC_WORD) {
+        tok->redir = REDIR_CLOSE;
+        return 1;
+    }
+    while (isdigit((unsigned char)p[n]) && n < 9) {
+        source = source * 10 + (p[n] - '0');
+        n++;
+    }
+    if (n == 0 || CLASS(p[n]) == CC_WORD) {
+        return 0;
+    }
+    tok->redir = REDIR_DUP;
+    tok->source = source;
+    return n;
+}
+
+/* Redirection commençant en p ('<' ou '>'), fd déjà lu devant (-1 : aucun) */
+static int lex_redirection(const char *p, int fd, token_t *tok) {
+    int n;
+    
+    if (p[0] == '<') {
+        if (p[1] == '<' && p[2] == '<') {
+            set_token(tok, TOK_REDIR, REDIR_STRING, "<<<");
+            tok->fd = (fd >= 0) ? fd : STDIN_FILENO;
+            return 3;
+        }
+        if (p[1] == '<' && p[2] == '-') {
+            set_token(tok, TOK_REDIR, REDIR_HEREDOC_TABS, "<<-");
+            tok->fd = (fd >= 0) ? fd : STDIN_FILENO;
+            return 3;
+        }
+        if (p[1] == '<') {
+            set_token(tok, TOK_REDIR, REDIR_HEREDOC, "<<");
+            tok->fd = (fd >= 0) ? fd : STDIN_FILENO;
+            return 2;
+        }
+        if (p[1] == '>') {
+            set_token(tok, TOK_REDIR, REDIR_READ_WRITE, "<>");
+            tok->fd = (fd >= 0) ? fd : STDIN_FILENO;
+            return 2;
+        }
+        if (p[1] == '&') {
+            /* <& n'accepte qu'un descripteur : sinon REDIR_NONE, erreur de syntaxe */
+            set_token(tok, TOK_REDIR, REDIR_NONE, "<&");
+            tok->fd = (fd >= 0) ? fd : STDIN_FILENO;
+            return 2 + lex_dup_source(p + 2, tok);
+        }
+        set_token(tok, TOK_REDIR, REDIR_IN, "<");
+        tok->fd = (fd >= 0) ? fd : STDIN_FILENO;
+        return 1;
+    }
+    
+    /* '>' */
+    if (p[1] == '>' && p[2] == '&') {
+        set_token(tok, TOK_REDIR, REDIR_BOTH_APPEND, ">>&");
+        return 3;
+    }
+    if (p[1] == '>') {
+        set_token(tok, TOK_REDIR, REDIR_OUT_APPEND, ">>");
+        tok->fd = (fd >= 0) ? fd : STDOUT_FILENO;
+        return 2;
+    }
+    if (p[1] == '&') {
+        /* >&2 copie un descripteur, >& fichier redirige stdout et stderr */
+        set_token(tok, TOK_REDIR, REDIR_BOTH, ">&");
+        tok->fd = (fd >= 0) ? fd : STDOUT_FILENO;
+        n = lex_dup_source(p + 2, tok);
+        return 2 + n;
+    }
+    set_token(tok, TOK_REDIR, REDIR_OUT, ">");
+    tok->fd = (fd >= 0) ? fd : STDOUT_FILENO;
+    return 1;
+}
+
+/* Opérateur commençant en p, renvoie sa longueur */
+static int lex_operator(const char *p, token_t *tok) {
+    switch (p[0]) {
+        case '|':
+            if (p[1] == '|') {
+                set_token(tok, TOK_OR, REDIR_NONE, "||");
+                return 2;
+            }
+            set_token(tok, TOK_PIPE, REDIR_NONE, "|");
+            return 1;
+        case '&':
+            if (p[1] == '&') {
+                set_token(tok, TOK_AND, REDIR_NONE, "&&");
+                return 2;
+            }
+            set_token(tok, TOK_AMP, REDIR_NONE, "&");
+            return 1;
+        case ';':
+            set_token(tok, TOK_SEMI, REDIR_NONE, ";");
+            return 1;
+        default:
+            return lex_redirection(p, -1, tok);
+    }
+}
+
+/*
+ * Lit le lexème suivant dans *tok (TOK_END en fin de ligne).
+ * Renvoie -1, message affiché, sur un guillemet non refermé.
+ */
+int lexer_next(lexer_t *lx, token_t *tok) {
+    const char *p = lx->pos;
+    const char *start;
+    char *word;
+    int quoted;
+    char *w;
+    
+    while (CLASS(*p) == CC_SPACE) {
+        p++;
+    }
+    
+    if (*p == '\0') {
+        lx->pos = p;
+        set_token(tok, TOK_END, REDIR_NONE, NULL);
+        return 0;
+    }
+    
+    /* N> N< ... : le numéro n'est un descripteur qu'en début de mot */
+    if (isdigit((unsigned char)*p)) {
+        const char *q = p;
+        int fd = 0;
+        
+        while (isdigit((unsigned char)*q) && q - p < 9) {
+            fd = fd * 10 + (*q++ - '0');
+        }
+        if (*q == '<' || *q == '>') {
+            lx->pos = q + lex_redirection(q, fd, tok);
+            return 0;
+        }
+    }
+    
+    if (CLASS(*p) == CC_OPERATOR) {
+        lx->pos = p + lex_operator(p, tok);
+        return 0;
+    }
+    
+    start = p;
+    word = w = lx->out;
+    quoted = 0;
+    while (1) {
+        while (CLASS(*p) == CC_WORD) {
+            *w++ = *p++;
+        }
+        
+        if (CLASS(*p) == CC_ESCAPE) {
+            if (p[1] == '\0') {
+                p++;
+                continue;
+            }
+            *w++ = p[1];
+            p += 2;
+            quoted = 1;
+        } else if (*p == '\'') {
+            /* Entre apostrophes tout est littéral */
+            const char *end = strchr(p + 1, '\'');
+            if (end == NULL) {
+                fprintf(stderr, "mysh: unterminated quote\n");
+                return -1;
+            }
+            memcpy(w, p + 1, end - p - 1);
+            w += end - p - 1;
+            p = end + 1;
+            quoted = 1;
+        } else if (*p == '"') {
+            /* Entre guillemets '\' ne protège que " et \ */
+            p++;
+            while (*p != '"') {
+                if (*p == '\0') {
+                    fprintf(stderr, "mysh: unterminated quote\n");
+                    return -1;
+                }
+                if (*p == '\\' && (p[1] == '"' || p[1] == '\\')) {
+                    p++;
+                }
+                *w++ = *p++;
+            }
+            p++;
+            quoted = 1;
+        } else {
+            break;
+        }
+    }
+    
+    *w++ = '\0';
+    set_token(tok, TOK_WORD, REDIR_NONE, word);
+    tok->quoted = quoted;
+    if (quoted) {
+        /* Sans guillemets ni '\', le mot est déjà son texte d'origine */
+        memcpy(w, start, p - start);
+        tok->raw = w;
+        w += p - start;
+        *w++ = '\0';
+    }
+    lx->out = w;
+    lx->pos = p;
+    return 0;
+}
@@ -1,20 +1,18 @@
 #include "mysh.h"
 
 /* Global variables */
-job_t *job_list = NULL;
-int job_counter = 0;
+job_table_t job_table;
 int last_status = 0;
 char *last_command = NULL;
 pid_t foreground_pid = -1;
-variable_t *local_vars = NULL;
-int shmid = -1;
 shared_env_t *shared_env = NULL;
+int signal_fd = -1;
+shell_opts_t shell_opts = { SPAWN_POSIX, GLOB_BUILTIN, 0, 0, 1, 0, 0 };
+shell_stats_t shell_stats;
 
 int main(int argc, char *argv[], char *envp[]) {
-    char line[MAX_LINE];
-    cmd_type_t type;
-    int background;
-    command_t *cmd;
+    char *line;
+    node_t *tree;
     
     (void)argc;
     (void)argv;
@@ -28,7 +26,7 @@ int main(int argc, char *argv[], char *envp[]) {
     /* Configuration des gestionnaires de signaux */
     setup_signals();
     
-    /* Boucle principale */
+    /* Boucle principale : read_line attend à la fois l'entrée et les signaux */
     while (1) {
         /* Vérifie les tâches en arrière-plan */
         check_background_jobs();
@@ -37,33 +35,31 @@ int main(int argc, char *argv[], char *envp[]) {
         print_prompt();
         
         /* Lit la commande */
-        if (fgets(line, MAX_LINE, stdin) == NULL) {
-            if (feof(stdin)) {
-                printf("\n");
-                break;
-            }
-            continue;
+        line = read_line();
+        if (line == NULL) {
+            printf("\n");
+            break;
         }
         
-        /* Supprime le saut de ligne final */
-        line[strcspn(line, "\n")] = '\0';
-        
         /* Ignore les lignes vides */
         if (strlen(trim_whitespace(line)) == 0) {
             continue;
         }
         
         /* Parse la commande */
-        cmd = parse_command(line, &type, &background);
-        if (cmd == NULL) {
-            continue;
-        }
+        tree = parse_command(line);
         
         /* Exécute la commande */
-        execute_command(cmd, type, background);
+        if (tree != NULL) {
+            execute_command(tree);
+        }
+        
+        /* Signaux arrivés pendant la commande */
+        handle_signal_events(0);
         
-        /* Libère la structure de commande */
-        free_command(cmd);
+        /* Libère d'un coup l'arbre de la ligne et ses documents en ligne */
+        close_here_documents();
+        arena_reset(&line_arena);
     }
     
     /* Nettoyage */
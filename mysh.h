@@ -4,6 +4,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/wait.h>
@@ -14,39 +15,97 @@
 #include <glob.h>
 #include <dirent.h>
 #include <pwd.h>
-#include <sys/ipc.h>
-#include <sys/shm.h>
-#include <semaphore.h>
+#include <sys/mman.h>
+#include <pthread.h>
+#include <spawn.h>
+#include <time.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <limits.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 
 #define MAX_LINE 4096
-#define MAX_ARGS 256
-#define MAX_JOBS 100
-#define MAX_VAR_NAME 256
-#define MAX_VAR_VALUE 4096
-#define SHM_SIZE 65536
 
-/* Command types */
+/* Types des noeuds de l'arbre syntaxique */
 typedef enum {
-    CMD_SIMPLE,
-    CMD_PIPE,
-    CMD_SEQUENCE,
-    CMD_AND,
-    CMD_OR,
-    CMD_BACKGROUND
+    CMD_SIMPLE,         /* feuille : une commande */
+    CMD_PIPE,           /* feuille : un pipeline */
+    CMD_SEQUENCE,       /* left ; right */
+    CMD_AND,            /* left && right */
+    CMD_OR,             /* left || right */
+    CMD_BACKGROUND      /* left & */
 } cmd_type_t;
 
 /* Redirection types */
 typedef enum {
     REDIR_NONE,
-    REDIR_IN,
-    REDIR_OUT,
-    REDIR_OUT_APPEND,
-    REDIR_ERR,
-    REDIR_ERR_APPEND,
-    REDIR_BOTH,
-    REDIR_BOTH_APPEND
+    REDIR_IN,               /* N< */
+    REDIR_OUT,              /* N> */
+    REDIR_OUT_APPEND,       /* N>> */
+    REDIR_BOTH,             /* >& fichier : stdout et stderr */
+    REDIR_BOTH_APPEND,      /* >>& */
+    REDIR_READ_WRITE,       /* N<> */
+    REDIR_DUP,              /* N>&M, N<&M */
+    REDIR_CLOSE,            /* N>&-, N<&- */
+    REDIR_STRING,           /* N<<< mot */
+    REDIR_HEREDOC,          /* N<< FIN */
+    REDIR_HEREDOC_TABS      /* N<<- FIN : tabulations de tête retirées */
 } redir_type_t;
 
+/* Une redirection d'une commande, appliquée dans l'ordre de la ligne */
+typedef struct redirection {
+    redir_type_t type;
+    int fd;                 /* descripteur remplacé */
+    int source;             /* REDIR_DUP : descripteur copié ; <<, <<< : leur contenu */
+    char *word;             /* fichier, texte de <<< ou délimiteur de << */
+    int expand;             /* << : délimiteur sans guillemets, $ développés à l'exécution */
+    struct redirection *next;
+} redirection_t;
+
+/* Contenu d'un document en ligne pendant sa lecture (voir redirections.c) */
+typedef struct {
+    char *buf;
+    size_t len;
+    size_t cap;
+    int memfd;              /* -1 tant que le contenu tient dans buf */
+} here_doc_t;
+
+/* Descripteur mis de côté pendant un builtin redirigé (copy < 0 : il était fermé) */
+typedef struct {
+    int fd;
+    int copy;
+    int cloexec;
+} saved_fd_t;
+
+/* Types des lexèmes (voir lexer.c) */
+typedef enum {
+    TOK_WORD,
+    TOK_PIPE,
+    TOK_AND,
+    TOK_OR,
+    TOK_SEMI,
+    TOK_AMP,
+    TOK_REDIR,
+    TOK_END
+} token_type_t;
+
+typedef struct {
+    token_type_t type;
+    redir_type_t redir;     /* pour TOK_REDIR */
+    int fd;                 /* TOK_REDIR : descripteur visé */
+    int source;             /* TOK_REDIR : descripteur copié par N>&M */
+    int quoted;             /* TOK_WORD : guillemets ou '\' rencontrés */
+    const char *text;       /* mot sans guillemets, ou texte de l'opérateur */
+    const char *raw;        /* TOK_WORD : mot tel qu'écrit, développé à l'exécution */
+} token_t;
+
+/* État de l'analyseur lexical d'une ligne */
+typedef struct {
+    const char *pos;
+    char *out;              /* prochain mot, dans line_arena */
+} lexer_t;
+
 /* Job states */
 typedef enum {
     JOB_RUNNING,
@@ -57,57 +116,244 @@ typedef enum {
 /* Job structure */
 typedef struct job {
     int job_id;
-    pid_t pid;
+    pid_t pid;          /* dernier processus, son statut est celui du job */
+    pid_t pgid;         /* 0 si le job partage le groupe du shell */
+    pid_t *pids;
+    int npids;
+    int nalive;
     char *command;
     job_state_t state;
     int status;
-    struct job *next;
 } job_t;
 
+/* Entrée de la table pid -> job (pid == 0 : case libre) */
+typedef struct {
+    pid_t pid;
+    job_t *job;
+} pid_slot_t;
+
+/* Table des jobs, voir jobs.c */
+typedef struct {
+    job_t **slots;
+    int capacity;
+    int highest;
+    int count;
+    pid_slot_t *pids;
+    unsigned int pid_capacity;
+    unsigned int pid_count;
+} job_table_t;
+
 /* Command structure */
 typedef struct command {
     char **argv;
     int argc;
-    redir_type_t redir_type;
-    char *redir_file;
+    int argv_cap;           /* places allouées dans argv, NULL final compris */
+    int glob_start;         /* plus grande expansion de motif : argv[glob_start..] */
+    int glob_count;
+    redirection_t *redirs;
     struct command *next;
 } command_t;
 
-/* Variable structure */
+/* Noeud de l'arbre syntaxique d'une ligne */
+typedef struct node {
+    cmd_type_t type;
+    command_t *cmd;         /* étapes du pipeline pour une feuille */
+    struct node *left;
+    struct node *right;
+} node_t;
+
+/* Entrée d'un répertoire mis en cache (type : d_type de readdir) */
+typedef struct {
+    const char *name;
+    size_t offset;
+    size_t len;
+    unsigned char type;
+} dir_entry_t;
+
+/* Contenu d'un répertoire, trié par nom (voir dircache.c) */
+typedef struct dir_listing {
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;
+    int valid;              /* 0 : lu trop près de sa modification, à relire */
+    int pins;
+    int orphan;             /* remplacé dans le cache, libéré au dernier release */
+    unsigned long last_use;
+    char *names;
+    dir_entry_t *entries;
+    int count;
+    struct dir_listing *next;
+} dir_listing_t;
+
+/* Parcours parallèle d'une arborescence pour ** (voir globstar.c) */
+typedef struct {
+    const char *root;           /* préfixe du chemin, "" pour le répertoire courant */
+    int (*match)(const void *pattern, const char *name, size_t len);
+    const void *pattern;
+    int dirs_only;
+    char **results;             /* chemins relatifs à root, triés */
+    size_t count;
+    unsigned long dirs;         /* répertoires lus */
+    int threads;
+    void *chunks;
+    void *state;
+} tree_walk_t;
+
+/* Moteurs d'expansion des motifs */
+typedef enum {
+    GLOB_LIBC,
+    GLOB_BUILTIN
+} glob_mode_t;
+
+/* Moteurs de création de processus */
+typedef enum {
+    SPAWN_FORK,
+    SPAWN_POSIX
+} spawn_mode_t;
+
+/* Bloc d'une arène (voir arena.c) */
+typedef struct arena_block {
+    struct arena_block *next;
+    size_t size;
+    size_t used;
+    char data[];
+} arena_block_t;
+
+/* Arène à incrément de pointeur, vidée en une fois */
+typedef struct {
+    arena_block_t *head;
+    unsigned long allocs;       /* allocations depuis le dernier reset */
+    size_t bytes;
+} arena_t;
+
+/* Options du shell (builtin myopt) */
+typedef struct {
+    spawn_mode_t spawn_mode;
+    glob_mode_t glob_mode;
+    int glob_threads;       /* threads du parcours de **, 0 : un par processeur */
+    int batch;              /* découpe des argv trop longs pour ARG_MAX */
+    int batch_jobs;         /* lots lancés en parallèle */
+    int pipe_stat;          /* relais instrumentés entre les étapes d'un pipeline */
+    int pipe_size;          /* capacité des tubes (F_SETPIPE_SZ), 0 : celle du noyau */
+} shell_opts_t;
+
+/* Relais du shell entre deux étapes d'un pipeline (voir relay.c) */
+typedef struct {
+    int in;                 /* lecture du tube de l'étape amont, -1 une fois fermé */
+    int out;                /* écriture du tube de l'étape aval */
+    int capacity;           /* capacité du tube aval */
+    int waiting_out;        /* dernière attente : aval plein (1) ou amont vide (0) */
+    unsigned long long bytes;
+    unsigned long long empty_ns;    /* attente d'un amont vide */
+    unsigned long long full_ns;     /* attente d'un aval plein */
+    unsigned long long end_ns;
+} relay_t;
+
+/* Compteurs de mesure (builtin mystats) */
+typedef struct {
+    unsigned long spawn_count[2];
+    unsigned long long spawn_ns[2];
+    unsigned long long spawn_max_ns[2];
+    unsigned long arena_lines;
+    unsigned long long arena_allocs;
+    unsigned long long arena_bytes;
+    unsigned long long arena_max_bytes;
+    unsigned long arena_mallocs;
+    unsigned long batch_commands;
+    unsigned long batch_runs;
+    unsigned long glob_count[2];
+    unsigned long long glob_ns[2];
+    unsigned long long glob_max_ns[2];
+    unsigned long glob_groups;          /* répertoires lus pour plusieurs motifs */
+    unsigned long glob_grouped;         /* motifs développés ainsi */
+    unsigned long dircache_hits;
+    unsigned long dircache_misses;
+    unsigned long globstar_walks;
+    unsigned long globstar_dirs;
+    unsigned long env_reads;
+    unsigned long env_retries;
+    unsigned long env_remaps;
+    unsigned long env_builds;
+    unsigned long relay_pipes;
+    unsigned long long relay_bytes;
+} shell_stats_t;
+
+/* Variable locale : liaison d'un nom interné dans un cadre (voir variables.c) */
 typedef struct variable {
-    char *name;
+    struct var_name *name;
     char *value;
-    struct variable *next;
+    size_t cap;                 /* taille du tampon de value, réutilisé */
+    int defined;                /* 0 après unset, le tampon est gardé */
+    int frame;
+    struct variable *shadowed;  /* même nom dans un cadre extérieur */
+    struct variable *frame_next;    /* liaison suivante du même cadre */
 } variable_t;
 
+/* Nom interné : un seul exemplaire par nom, jamais libéré */
+typedef struct var_name {
+    char *text;
+    uint32_t hash;
+    variable_t *binding;        /* liaison du cadre le plus intérieur */
+    struct var_name *next;
+} var_name_t;
+
 /* memoire partagée */
+#define ENV_MAGIC 0x4d595348u       /* "MYSH" */
+#define ENV_VERSION 6
+#define ENV_MIN_SHIFT 5             /* plus petit bloc : 32 octets */
+#define ENV_MAX_SHIFT 30            /* taille maximale de l'objet : 1 Go */
+/* Blocs de 32 octets à la moitié de l'objet maximal (512 Mo) */
+#define ENV_CLASSES (ENV_MAX_SHIFT - ENV_MIN_SHIFT)
+
+/* Entrée de l'environnement partagé, dans le tas du segment */
+typedef struct {
+    uint32_t size;              /* taille du bloc, puissance de 2 */
+    uint32_t hash;              /* bloc suivant de la liste libre une fois libéré */
+    uint32_t name_len;
+    uint32_t value_len;
+    char text[];                /* NOM=valeur */
+} env_entry_t;
+
+/* En-tête du segment, suivi de l'index puis du tas (voir variables.c) */
 typedef struct {
-    int initialized;
-    int ref_count;
-    sem_t readers_sem;
-    sem_t writers_sem;
-    sem_t mutex;
-    int readers_count;
-    int writers_waiting;
-    char data[SHM_SIZE - 256];
+    uint32_t magic;
+    uint32_t version;
+    pthread_mutex_t write_lock; /* écrivains : robuste, partagé entre processus */
+    atomic_uint seq;            /* impair pendant une écriture (seqlock) */
+    atomic_uint generation;     /* incrémenté à chaque agrandissement */
+    atomic_uint map_size;       /* taille de l'objet, en-tête compris */
+    atomic_uint changes;        /* incrémenté après chaque écriture (futex) */
+    atomic_uint waiters;        /* shells endormis sur changes */
+    uint32_t data_size;
+    uint32_t index_slots;       /* puissance de 2 */
+    uint32_t count;
+    uint32_t tombstones;
+    uint32_t heap_used;         /* fin du tas, décalage dans data */
+    uint32_t free_lists[ENV_CLASSES];
+    char data[];
 } shared_env_t;
 
 /* Variables globales */
-extern job_t *job_list;
-extern int job_counter;
+extern job_table_t job_table;
 extern int last_status;
 extern char *last_command;
 extern pid_t foreground_pid;
-extern variable_t *local_vars;
-extern int shmid;
 extern shared_env_t *shared_env;
+extern int signal_fd;
+extern shell_opts_t shell_opts;
+extern shell_stats_t shell_stats;
+extern arena_t line_arena;
 
 /* parser.c */
-command_t *parse_command(char *line, cmd_type_t *type, int *background);
-void free_command(command_t *cmd);
+node_t *parse_command(char *line);
+int add_argument(command_t *cmd, char *arg);
+
+/* lexer.c */
+int lexer_init(lexer_t *lx, const char *line);
+int lexer_next(lexer_t *lx, token_t *tok);
 
 /* executor.c */
-int execute_command(command_t *cmd, cmd_type_t type, int background);
+int execute_command(node_t *node);
 int execute_pipeline(command_t *cmd);
 int execute_simple_command(command_t *cmd);
 
@@ -120,36 +366,90 @@ int builtin_status(char **argv);
 int builtin_myjobs(char **argv);
 int builtin_myfg(char **argv);
 int builtin_mybg(char **argv);
+int builtin_myopt(char **argv);
+int builtin_mystats(char **argv);
 
 /* wildcards.c */
-char **expand_wildcards(char **argv, int *argc);
+int expand_command(command_t *cmd);
+
+/* arena.c */
+void *arena_alloc(arena_t *arena, size_t size);
+void *arena_grow(arena_t *arena, void *ptr, size_t old_size, size_t new_size);
+char *arena_strdup(arena_t *arena, const char *str);
+void arena_reset(arena_t *arena);
+
+/* dircache.c */
+dir_listing_t *dircache_get(const char *path);
+void dircache_release(dir_listing_t *listing);
+
+/* globstar.c */
+int tree_walk(tree_walk_t *walk);
+void tree_walk_free(tree_walk_t *walk);
+
+/* spawn.c */
+pid_t spawn_process(command_t *cmd, int fd_in, int fd_out, pid_t pgid, int *err_status);
+
+/* relay.c */
+void set_pipe_size(int fd);
+void run_relays(relay_t *relays, int count, pid_t *pids, int npids);
+void print_relays(command_t *cmd, relay_t *relays, int count, unsigned long long start);
+
+/* hash.c */
+char *find_command(char *name);
+void forget_command(char *name);
+void clear_command_hash(void);
+int builtin_hash(char **argv);
+
+/* tee.c */
+int builtin_mytee(char **argv);
 
 /* redirections.c */
 int setup_redirections(command_t *cmd);
-void restore_redirections(int saved_stdin, int saved_stdout, int saved_stderr);
+int open_redirection(redirection_t *redir);
+int redirection_targets(redirection_t *redir, int *fds);
+int redirection_copies_fd(redirection_t *redir);
+saved_fd_t *redirect_in_shell(command_t *cmd, int fd_in);
+void restore_redirections(saved_fd_t *saved);
+int here_init(here_doc_t *doc);
+int here_append(here_doc_t *doc, const char *data, size_t len);
+int here_finish(here_doc_t *doc);
+int here_string(redirection_t *redir);
+int expand_here_document(redirection_t *redir);
+void close_here_documents(void);
 
 /* jobs.c */
-job_t *add_job(pid_t pid, char *command);
+job_t *add_job(pid_t *pids, int npids, pid_t pgid, char *command);
 void remove_job(int job_id);
 job_t *get_job_by_id(int job_id);
 job_t *get_job_by_pid(pid_t pid);
 void check_background_jobs(void);
+int reap_children(int at_prompt);
+void signal_job(job_t *job, int sig);
+int wait_job(job_t *job);
 void print_jobs(void);
 int get_highest_job_id(void);
+int job_event_room(void);
+void job_event_push(pid_t pid, int status);
 
 /* variables.c */
 int init_shared_env(char **envp);
 void cleanup_shared_env(void);
-char *get_variable(char *name);
+ssize_t lookup_variable(const char *name, size_t len, char *buf, size_t size);
+char *dup_variable(const char *name);
 void set_local_variable(char *name, char *value);
 void unset_local_variable(char *name);
+void declare_local_variable(char *name, char *value);
+int push_variable_frame(void);
+void pop_variable_frame(void);
 void set_env_variable(char *name, char *value);
 void unset_env_variable(char *name);
 char *expand_variables(char *str);
+int expand_word(const char *word, command_t *out, int split);
 void print_local_variables(void);
 void print_env_variables(void);
-void lock_read_env(void);
-void unlock_read_env(void);
+char **get_env_array(void);
+unsigned int env_changes(void);
+int builtin_waitenv(char **argv);
 void lock_write_env(void);
 void unlock_write_env(void);
 
@@ -158,11 +458,18 @@ void setup_signals(void);
 void sigchld_handler(int sig);
 void sigint_handler(int sig);
 void sigtstp_handler(int sig);
+int handle_signal_events(int at_prompt);
+void confirm_exit(void);
+void block_sigchld(sigset_t *saved);
+void restore_sigmask(sigset_t *saved);
 
 /* utils.c */
 char *get_current_dir(void);
 char *expand_tilde(char *path);
 void print_prompt(void);
+char *read_line(void);
 char *trim_whitespace(char *str);
+unsigned long long now_ns(void);
+int write_all(int fd, const char *data, size_t len);
 
 #endif /* MYSH_H */
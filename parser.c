@@ -1,237 +1,341 @@
 #include "mysh.h"
 
+#define ARGV_INITIAL_SIZE 8
+
+/* Les commandes, mots et noeuds d'une ligne vivent dans line_arena */
 static command_t *create_command(void) {
-    command_t *cmd = malloc(sizeof(command_t));
+    command_t *cmd = arena_alloc(&line_arena, sizeof(command_t));
     if (cmd == NULL) {
-        perror("malloc");
         return NULL;
     }
     
-    cmd->argv = malloc(sizeof(char *) * MAX_ARGS);
+    cmd->argv = arena_alloc(&line_arena, sizeof(char *) * ARGV_INITIAL_SIZE);
     if (cmd->argv == NULL) {
-        perror("malloc");
-        free(cmd);
         return NULL;
     }
     
     cmd->argc = 0;
-    cmd->redir_type = REDIR_NONE;
-    cmd->redir_file = NULL;
+    cmd->argv_cap = ARGV_INITIAL_SIZE;
+    cmd->argv[0] = NULL;
+    cmd->glob_start = 0;
+    cmd->glob_count = 0;
+    cmd->redirs = NULL;
     cmd->next = NULL;
     
     return cmd;
 }
 
-void free_command(command_t *cmd) {
-    command_t *current = cmd;
-    command_t *next;
-    
-    while (current != NULL) {
-        next = current->next;
-        
-        if (current->argv != NULL) {
-            for (int i = 0; i < current->argc; i++) {
-                free(current->argv[i]);
-            }
-            free(current->argv);
+/* Ajoute arg à argv (doublé quand il est plein) et garde argv terminé par NULL */
+int add_argument(command_t *cmd, char *arg) {
+    if (cmd->argc + 1 >= cmd->argv_cap) {
+        int new_cap = cmd->argv_cap * 2;
+        char **argv = arena_grow(&line_arena, cmd->argv, sizeof(char *) * cmd->argv_cap,
+                                 sizeof(char *) * new_cap);
+        if (argv == NULL) {
+            return -1;
         }
-        
-        if (current->redir_file != NULL) {
-            free(current->redir_file);
-        }
-        
-        free(current);
-        current = next;
+        cmd->argv = argv;
+        cmd->argv_cap = new_cap;
+    }
+    
+    cmd->argv[cmd->argc++] = arg;
+    cmd->argv[cmd->argc] = NULL;
+    return 0;
+}
+
+static node_t *create_node(cmd_type_t type, node_t *left, node_t *right) {
+    node_t *node = arena_alloc(&line_arena, sizeof(node_t));
+    if (node == NULL) {
+        return NULL;
     }
+    
+    node->type = type;
+    node->cmd = NULL;
+    node->left = left;
+    node->right = right;
+    
+    return node;
+}
+
+/* État du parseur : pipeline, chaîne && / || et liste en cours de construction */
+typedef struct {
+    command_t *first_cmd;
+    command_t *current_cmd;
+    node_t *and_or;
+    cmd_type_t and_or_op;
+    node_t *list;
+    redirection_t **heredocs;  /* << de la ligne, dans l'ordre, lus après elle */
+    int heredoc_count;
+    int heredoc_cap;
+} parse_state_t;
+
+static int syntax_error(const char *token) {
+    fprintf(stderr, "mysh: syntax error near '%s'\n", token != NULL ? token : "newline");
+    return -1;
 }
 
-static int is_operator(char *token) {
-    return (strcmp(token, "|") == 0 ||
-            strcmp(token, ";") == 0 ||
-            strcmp(token, "&&") == 0 ||
-            strcmp(token, "||") == 0 ||
-            strcmp(token, "&") == 0 ||
-            strcmp(token, ">") == 0 ||
-            strcmp(token, ">>") == 0 ||
-            strcmp(token, "2>") == 0 ||
-            strcmp(token, "2>>") == 0 ||
-            strcmp(token, ">&") == 0 ||
-            strcmp(token, ">>&") == 0 ||
-            strcmp(token, "<") == 0);
+/* Termine le pipeline courant et l'accroche à la chaîne && / || */
+static int end_pipeline(parse_state_t *st, const char *token) {
+    node_t *leaf;
+    
+    if (st->current_cmd->argc == 0 && st->current_cmd->redirs == NULL) {
+        /* Étape vide : seule une liste vide ou terminée par ; ou & est admise */
+        if (st->first_cmd != st->current_cmd || st->and_or != NULL) {
+            return syntax_error(token);
+        }
+        st->first_cmd = st->current_cmd = NULL;
+        return 0;
+    }
+    
+    /* Dans un pipeline chaque étape doit avoir une commande */
+    if (st->current_cmd->argc == 0 && st->first_cmd != st->current_cmd) {
+        return syntax_error(token);
+    }
+    
+    leaf = create_node(st->first_cmd->next != NULL ? CMD_PIPE : CMD_SIMPLE, NULL, NULL);
+    if (leaf == NULL) {
+        return -1;
+    }
+    leaf->cmd = st->first_cmd;
+    st->first_cmd = st->current_cmd = NULL;
+    
+    if (st->and_or == NULL) {
+        st->and_or = leaf;
+    } else {
+        node_t *node = create_node(st->and_or_op, st->and_or, leaf);
+        if (node == NULL) {
+            return -1;
+        }
+        st->and_or = node;
+    }
+    
+    return 0;
 }
 
-static char *get_next_token(char **line_ptr) {
-    char *line = *line_ptr;
-    static char token[MAX_LINE];
-    int i = 0;
-    int in_quotes = 0;
-    int escape = 0;
+/* Termine la chaîne courante (arrière-plan si background) et l'ajoute à la liste */
+static int end_and_or(parse_state_t *st, int background, const char *token) {
+    node_t *node;
     
-    while (*line && (*line == ' ' || *line == '\t')) {
-        line++;
+    if (end_pipeline(st, token) < 0) {
+        return -1;
     }
     
-    if (*line == '\0') {
-        *line_ptr = line;
-        return NULL;
+    if (st->and_or == NULL) {
+        return background ? syntax_error(token) : 0;
     }
     
-    if (strncmp(line, "2>>", 3) == 0) {
-        strcpy(token, "2>>");
-        *line_ptr = line + 3;
-        return token;
-    }
-    if (strncmp(line, ">>&", 3) == 0) {
-        strcpy(token, ">>&");
-        *line_ptr = line + 3;
-        return token;
-    }
-    if (strncmp(line, ">>", 2) == 0) {
-        strcpy(token, ">>");
-        *line_ptr = line + 2;
-        return token;
-    }
-    if (strncmp(line, "2>", 2) == 0) {
-        strcpy(token, "2>");
-        *line_ptr = line + 2;
-        return token;
-    }
-    if (strncmp(line, ">&", 2) == 0) {
-        strcpy(token, ">&");
-        *line_ptr = line + 2;
-        return token;
-    }
-    if (strncmp(line, "&&", 2) == 0) {
-        strcpy(token, "&&");
-        *line_ptr = line + 2;
-        return token;
-    }
-    if (strncmp(line, "||", 2) == 0) {
-        strcpy(token, "||");
-        *line_ptr = line + 2;
-        return token;
-    }
-    if (*line == '|' || *line == '&' || *line == ';' || *line == '<' || *line == '>') {
-        token[0] = *line;
-        token[1] = '\0';
-        *line_ptr = line + 1;
-        return token;
-    }
-    
-    while (*line && (in_quotes || (!is_operator(line) && *line != ' ' && *line != '\t'))) {
-        if (escape) {
-            token[i++] = *line;
-            escape = 0;
-        } else if (*line == '\\') {
-            escape = 1;
-        } else if (*line == '"' || *line == '\'') {
-            in_quotes = !in_quotes;
-        } else {
-            token[i++] = *line;
+    node = st->and_or;
+    if (background) {
+        node = create_node(CMD_BACKGROUND, st->and_or, NULL);
+        if (node == NULL) {
+            return -1;
         }
-        line++;
     }
+    st->and_or = NULL;
     
-    token[i] = '\0';
-    *line_ptr = line;
+    if (st->list == NULL) {
+        st->list = node;
+    } else {
+        node_t *seq = create_node(CMD_SEQUENCE, st->list, node);
+        if (seq == NULL) {
+            return -1;
+        }
+        st->list = seq;
+    }
     
-    return token;
+    return 0;
 }
 
-command_t *parse_command(char *line, cmd_type_t *type, int *background) {
-    command_t *first_cmd = NULL;
-    command_t *current_cmd = NULL;
-    char *line_ptr = line;
-    char *token;
-    int expect_file = 0;
-    redir_type_t pending_redir = REDIR_NONE;
-    
-    *type = CMD_SIMPLE;
-    *background = 0;
+static int start_command(parse_state_t *st) {
+    command_t *cmd = create_command();
+    if (cmd == NULL) {
+        return -1;
+    }
     
-    char *expanded = expand_variables(line);
-    if (expanded != NULL) {
-        line_ptr = expanded;
+    if (st->first_cmd == NULL) {
+        st->first_cmd = cmd;
+    } else {
+        st->current_cmd->next = cmd;
     }
+    st->current_cmd = cmd;
+    
+    return 0;
+}
+
+/* Ajoute la redirection de tok à la fin de la liste de cmd, dans l'ordre de la ligne */
+static redirection_t *add_redirection(command_t *cmd, const token_t *tok) {
+    redirection_t *redir = arena_alloc(&line_arena, sizeof(redirection_t));
+    redirection_t **tail = &cmd->redirs;
     
-    current_cmd = create_command();
-    if (current_cmd == NULL) {
+    if (redir == NULL) {
         return NULL;
     }
-    first_cmd = current_cmd;
+    redir->type = tok->redir;
+    redir->fd = tok->fd;
+    redir->source = tok->source;
+    redir->word = NULL;
+    redir->expand = 0;
+    redir->next = NULL;
     
-    while ((token = get_next_token(&line_ptr)) != NULL) {
-        if (expect_file) {
-            current_cmd->redir_file = strdup(token);
-            expect_file = 0;
-            continue;
+    while (*tail != NULL) {
+        tail = &(*tail)->next;
+    }
+    *tail = redir;
+    return redir;
+}
+
+/* Retient un << dont le contenu sera lu une fois la ligne analysée */
+static int add_heredoc(parse_state_t *st, redirection_t *redir) {
+    if (st->heredoc_count == st->heredoc_cap) {
+        int new_cap = st->heredoc_cap ? st->heredoc_cap * 2 : 4;
+        redirection_t **grown = arena_grow(&line_arena, st->heredocs,
+                                           sizeof(redirection_t *) * st->heredoc_cap,
+                                           sizeof(redirection_t *) * new_cap);
+        if (grown == NULL) {
+            return -1;
         }
-        
-        if (strcmp(token, ">") == 0) {
-            pending_redir = REDIR_OUT;
-            expect_file = 1;
-        } else if (strcmp(token, ">>") == 0) {
-            pending_redir = REDIR_OUT_APPEND;
-            expect_file = 1;
-        } else if (strcmp(token, "2>") == 0) {
-            pending_redir = REDIR_ERR;
-            expect_file = 1;
-        } else if (strcmp(token, "2>>") == 0) {
-            pending_redir = REDIR_ERR_APPEND;
-            expect_file = 1;
-        } else if (strcmp(token, ">&") == 0) {
-            pending_redir = REDIR_BOTH;
-            expect_file = 1;
-        } else if (strcmp(token, ">>&") == 0) {
-            pending_redir = REDIR_BOTH_APPEND;
-            expect_file = 1;
-        } else if (strcmp(token, "<") == 0) {
-            pending_redir = REDIR_IN;
-            expect_file = 1;
-        } else if (strcmp(token, "|") == 0) {
-            *type = CMD_PIPE;
-            current_cmd->redir_type = pending_redir;
-            pending_redir = REDIR_NONE;
-            
-            command_t *new_cmd = create_command();
-            if (new_cmd == NULL) {
-                free_command(first_cmd);
-                return NULL;
-            }
-            current_cmd->next = new_cmd;
-            current_cmd = new_cmd;
-        } else if (strcmp(token, ";") == 0) {
-            if (*type != CMD_PIPE) {
-                *type = CMD_SEQUENCE;
+        st->heredocs = grown;
+        st->heredoc_cap = new_cap;
+    }
+    st->heredocs[st->heredoc_count++] = redir;
+    return 0;
+}
+
+/*
+ * Lit sur l'entrée du shell le contenu d'un <<, ligne par ligne jusqu'au
+ * délimiteur : il est transmis au fur et à mesure à here_append(), sans
+ * limite de taille. <<- retire les tabulations de tête. Les $ restent tels
+ * quels, développés quand la commande s'exécute.
+ */
+static int read_heredoc(redirection_t *redir) {
+    int interactive = isatty(STDIN_FILENO);
+    here_doc_t doc;
+    char *line;
+    
+    if (here_init(&doc) < 0) {
+        return -1;
+    }
+    
+    while (1) {
+        if (interactive) {
+            printf("> ");
+            fflush(stdout);
+        }
+        line = read_line();
+        if (line == NULL) {
+            fprintf(stderr, "mysh: fin de fichier avant le délimiteur '%s'\n", redir->word);
+            break;
+        }
+        if (redir->type == REDIR_HEREDOC_TABS) {
+            while (*line == '\t') {
+                line++;
             }
-        } else if (strcmp(token, "&&") == 0) {
-            if (*type != CMD_PIPE) {
-                *type = CMD_AND;
+        }
+        if (strcmp(line, redir->word) == 0) {
+            break;
+        }
+        if (here_append(&doc, line, strlen(line)) < 0 || here_append(&doc, "\n", 1) < 0) {
+            return -1;
+        }
+    }
+    
+    redir->source = here_finish(&doc);
+    return redir->source >= 0 ? 0 : -1;
+}
+
+/*
+ * Construit l'arbre d'une ligne : une liste (; et &) de chaînes (&& et ||)
+ * de pipelines (|). Les opérateurs && et || ont la même priorité et sont
+ * associatifs à gauche, comme dans sh.
+ */
+node_t *parse_command(char *line) {
+    parse_state_t st = { NULL, NULL, NULL, CMD_AND, NULL, NULL, 0, 0 };
+    lexer_t lx;
+    token_t tok;
+    redirection_t *pending = NULL;
+    int err = 0;
+    
+    /* Les mots gardent leurs $, guillemets et motifs : chaque commande les
+     * développe au moment de s'exécuter (voir expand_command()) */
+    err = lexer_init(&lx, line);
+    if (!err) {
+        err = start_command(&st);
+    }
+    
+    while (!err && (err = lexer_next(&lx, &tok)) == 0 && tok.type != TOK_END) {
+        if (pending != NULL) {
+            if (tok.type != TOK_WORD) {
+                err = syntax_error(tok.text);
+                break;
             }
-        } else if (strcmp(token, "||") == 0) {
-            if (*type != CMD_PIPE) {
-                *type = CMD_OR;
+            pending->word = (char *)tok.raw;
+            if (pending->type == REDIR_HEREDOC || pending->type == REDIR_HEREDOC_TABS) {
+                pending->word = (char *)tok.text;
+                pending->expand = !tok.quoted;
+                err = add_heredoc(&st, pending);
             }
-        } else if (strcmp(token, "&") == 0) {
-            *background = 1;
-        } else {
-            current_cmd->argv[current_cmd->argc++] = strdup(token);
+            pending = NULL;
+            continue;
         }
         
-        if (expect_file) {
-            current_cmd->redir_type = pending_redir;
+        switch (tok.type) {
+            case TOK_REDIR:
+                if (tok.redir == REDIR_NONE) {
+                    err = syntax_error(tok.text);
+                    break;
+                }
+                pending = add_redirection(st.current_cmd, &tok);
+                if (pending == NULL) {
+                    err = -1;
+                } else if (tok.redir == REDIR_DUP || tok.redir == REDIR_CLOSE) {
+                    /* N>&M et N>&- sont complets, sans mot à suivre */
+                    pending = NULL;
+                }
+                break;
+                
+            case TOK_PIPE:
+                if (st.current_cmd->argc == 0) {
+                    err = syntax_error(tok.text);
+                } else {
+                    err = start_command(&st);
+                }
+                break;
+                
+            case TOK_AND:
+            case TOK_OR:
+                if (st.current_cmd->argc == 0) {
+                    err = syntax_error(tok.text);
+                } else if ((err = end_pipeline(&st, tok.text)) == 0) {
+                    st.and_or_op = (tok.type == TOK_AND) ? CMD_AND : CMD_OR;
+                    err = start_command(&st);
+                }
+                break;
+                
+            case TOK_SEMI:
+            case TOK_AMP:
+                if ((err = end_and_or(&st, tok.type == TOK_AMP, tok.text)) == 0) {
+                    err = start_command(&st);
+                }
+                break;
+                
+            default:
+                err = add_argument(st.current_cmd, (char *)tok.raw);
+                break;
         }
     }
     
-    for (command_t *cmd = first_cmd; cmd != NULL; cmd = cmd->next) {
-        cmd->argv[cmd->argc] = NULL;
-        
-        cmd->argv = expand_wildcards(cmd->argv, &cmd->argc);
+    if (!err && pending != NULL) {
+        err = syntax_error(NULL);
+    }
+    if (!err) {
+        err = end_and_or(&st, 0, NULL);
     }
     
-    if (expanded != NULL) {
-        free(expanded);
+    /* Les contenus des << suivent la ligne, dans l'ordre des délimiteurs */
+    for (int i = 0; !err && i < st.heredoc_count; i++) {
+        err = read_heredoc(st.heredocs[i]);
     }
     
-    return first_cmd;
+    /* En cas d'erreur, les morceaux déjà construits partent au reset de l'arène */
+    return err ? NULL : st.list;
 }
@@ -1,103 +1,423 @@
 #include "mysh.h"
 
-int setup_redirections(command_t *cmd) {
-    int fd;
-    
-    if (cmd->redir_type == REDIR_NONE) {
-        return 0;
-    }
-    
-    switch (cmd->redir_type) {
+/*
+ * Redirections d'une commande : une liste appliquée dans l'ordre de la ligne,
+ * après les tubes du pipeline. Chaque fichier est ouvert une seule fois, en
+ * O_CLOEXEC : seul le descripteur visé, posé par dup2, passe à la commande.
+ */
+
+static int redirection_flags(redir_type_t type) {
+    switch (type) {
         case REDIR_IN:
-            fd = open(cmd->redir_file, O_RDONLY);
-            if (fd < 0) {
-                perror(cmd->redir_file);
-                return -1;
-            }
-            dup2(fd, STDIN_FILENO);
-            close(fd);
-            break;
-            
+            return O_RDONLY;
         case REDIR_OUT:
-            fd = open(cmd->redir_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-            if (fd < 0) {
-                perror(cmd->redir_file);
-                return -1;
-            }
-            dup2(fd, STDOUT_FILENO);
-            close(fd);
-            break;
-            
+        case REDIR_BOTH:
+            return O_WRONLY | O_CREAT | O_TRUNC;
         case REDIR_OUT_APPEND:
-            fd = open(cmd->redir_file, O_WRONLY | O_CREAT | O_APPEND, 0644);
-            if (fd < 0) {
-                perror(cmd->redir_file);
-                return -1;
-            }
-            dup2(fd, STDOUT_FILENO);
-            close(fd);
-            break;
-            
-        case REDIR_ERR:
-            fd = open(cmd->redir_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-            if (fd < 0) {
-                perror(cmd->redir_file);
+        case REDIR_BOTH_APPEND:
+            return O_WRONLY | O_CREAT | O_APPEND;
+        case REDIR_READ_WRITE:
+            return O_RDWR | O_CREAT;
+        default:
+            return -1;
+    }
+}
+
+/* Descripteurs à remplacer par la redirection, renvoie leur nombre */
+int redirection_targets(redirection_t *redir, int *fds) {
+    switch (redir->type) {
+        case REDIR_BOTH:
+        case REDIR_BOTH_APPEND:
+            fds[0] = STDOUT_FILENO;
+            fds[1] = STDERR_FILENO;
+            return 2;
+        case REDIR_NONE:
+            return 0;
+        default:
+            fds[0] = redir->fd;
+            return 1;
+    }
+}
+
+/* Ouvre le fichier de la redirection, en O_CLOEXEC */
+int open_redirection(redirection_t *redir) {
+    int fd = open(redir->word, redirection_flags(redir->type) | O_CLOEXEC, 0644);
+    
+    if (fd < 0) {
+        perror(redir->word);
+    }
+    return fd;
+}
+
+/* Vrai si la redirection copie un descripteur déjà ouvert (N>&M, <<, <<<) */
+int redirection_copies_fd(redirection_t *redir) {
+    switch (redir->type) {
+        case REDIR_DUP:
+        case REDIR_STRING:
+        case REDIR_HEREDOC:
+        case REDIR_HEREDOC_TABS:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+/*
+ * Documents en ligne (<<, <<-, <<<) : le contenu est lu par le parseur et
+ * accumulé par blocs de HERE_CHUNK octets ; le texte de <<< et les $ d'un <<
+ * sans guillemets sont développés quand la commande s'exécute. Un contenu
+ * qui tient dans un tube y est écrit d'avance ; au-delà il déborde au fil de
+ * la lecture dans un memfd scellé (F_SEAL_WRITE...) que la commande peut
+ * relire ou projeter.
+ * Aucun fichier temporaire ; les descripteurs, au-dessus de 10 et en
+ * O_CLOEXEC, sont fermés par close_here_documents() après la ligne.
+ */
+
+#define HERE_CHUNK 65536
+
+static int *here_fds = NULL;
+static int here_count = 0;
+static int here_cap = 0;
+
+int here_init(here_doc_t *doc) {
+    doc->buf = arena_alloc(&line_arena, HERE_CHUNK);
+    doc->len = 0;
+    doc->cap = HERE_CHUNK;
+    doc->memfd = -1;
+    return doc->buf != NULL ? 0 : -1;
+}
+
+/* Vide le tampon dans le memfd, créé au premier débordement */
+static int here_flush(here_doc_t *doc) {
+    if (doc->memfd < 0) {
+        doc->memfd = memfd_create("mysh-heredoc", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+        if (doc->memfd < 0) {
+            perror("memfd_create");
+            return -1;
+        }
+    }
+    if (write_all(doc->memfd, doc->buf, doc->len) < 0) {
+        perror("<<");
+        return -1;
+    }
+    doc->len = 0;
+    return 0;
+}
+
+/* Ajoute len octets au document ; seul le dernier bloc reste en mémoire */
+int here_append(here_doc_t *doc, const char *data, size_t len) {
+    if (doc->len + len > doc->cap) {
+        if (here_flush(doc) < 0) {
+            return -1;
+        }
+        if (len > doc->cap) {
+            if (write_all(doc->memfd, data, len) < 0) {
+                perror("<<");
                 return -1;
             }
-            dup2(fd, STDERR_FILENO);
-            close(fd);
-            break;
+            return 0;
+        }
+    }
+    memcpy(doc->buf + doc->len, data, len);
+    doc->len += len;
+    return 0;
+}
+
+/* Garde fd (déplacé au-dessus de 10) pour close_here_documents() */
+static int here_register(int fd) {
+    int high = fcntl(fd, F_DUPFD_CLOEXEC, 10);
+    
+    close(fd);
+    if (high < 0) {
+        perror("fcntl");
+        return -1;
+    }
+    if (here_count == here_cap) {
+        int new_cap = here_cap ? here_cap * 2 : 4;
+        int *grown = realloc(here_fds, sizeof(int) * new_cap);
+        if (grown == NULL) {
+            perror("realloc");
+            close(high);
+            return -1;
+        }
+        here_fds = grown;
+        here_cap = new_cap;
+    }
+    here_fds[here_count++] = high;
+    return high;
+}
+
+/* Termine le document : renvoie le descripteur à lire depuis le début, -1 si erreur */
+int here_finish(here_doc_t *doc) {
+    int fd;
+    
+    if (doc->memfd < 0) {
+        int pipefd[2];
+        
+        if (pipe2(pipefd, O_CLOEXEC) < 0) {
+            perror("pipe");
+            return -1;
+        }
+        /* Écrit d'avance, le contenu ne doit pas bloquer sur un tube plein */
+        if ((size_t)fcntl(pipefd[1], F_GETPIPE_SZ) >= doc->len) {
+            int err = write_all(pipefd[1], doc->buf, doc->len);
             
-        case REDIR_ERR_APPEND:
-            fd = open(cmd->redir_file, O_WRONLY | O_CREAT | O_APPEND, 0644);
-            if (fd < 0) {
-                perror(cmd->redir_file);
+            close(pipefd[1]);
+            if (err < 0) {
+                perror("<<");
+                close(pipefd[0]);
                 return -1;
             }
-            dup2(fd, STDERR_FILENO);
-            close(fd);
-            break;
+            return here_register(pipefd[0]);
+        }
+        close(pipefd[0]);
+        close(pipefd[1]);
+    }
+    
+    if (here_flush(doc) < 0) {
+        if (doc->memfd >= 0) {
+            close(doc->memfd);
+        }
+        return -1;
+    }
+    fd = doc->memfd;
+    doc->memfd = -1;
+    if (fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) < 0 ||
+        lseek(fd, 0, SEEK_SET) < 0) {
+        perror("<<");
+        close(fd);
+        return -1;
+    }
+    return here_register(fd);
+}
+
+/* Contenu de <<< : le mot, déjà développé, suivi d'un '\n' */
+int here_string(redirection_t *redir) {
+    here_doc_t doc;
+    
+    if (here_init(&doc) < 0 ||
+        here_append(&doc, redir->word, strlen(redir->word)) < 0 ||
+        here_append(&doc, "\n", 1) < 0) {
+        return -1;
+    }
+    redir->source = here_finish(&doc);
+    return redir->source >= 0 ? 0 : -1;
+}
+
+/* Ajoute au document la ligne line (len octets, '\n' compris), $ développés */
+static int here_append_expanded(here_doc_t *doc, char *line, size_t len) {
+    char *expanded;
+    
+    line[len] = '\0';
+    expanded = expand_variables(line);
+    if (expanded == NULL) {
+        return -1;
+    }
+    return here_append(doc, expanded, strlen(expanded));
+}
+
+/*
+ * Relit le contenu d'un << sans guillemets et le remplace par un nouveau
+ * document où chaque ligne a ses $ développés, avec les variables du moment
+ * où la commande s'exécute. L'ancien descripteur part avec les autres.
+ */
+int expand_here_document(redirection_t *redir) {
+    size_t cap = HERE_CHUNK;
+    size_t len = 0;
+    char *line = arena_alloc(&line_arena, cap + 1);
+    here_doc_t doc;
+    ssize_t n;
+    
+    if (line == NULL || here_init(&doc) < 0) {
+        return -1;
+    }
+    
+    while ((n = read(redir->source, line + len, cap - len)) != 0) {
+        size_t start = 0;
+        char *nl;
+        
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            perror("<<");
+            return -1;
+        }
+        len += n;
+        
+        while ((nl = memchr(line + start, '\n', len - start)) != NULL) {
+            size_t end = nl - line + 1;
+            char saved = line[end];
             
-        case REDIR_BOTH:
-            fd = open(cmd->redir_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-            if (fd < 0) {
-                perror(cmd->redir_file);
+            if (here_append_expanded(&doc, line + start, end - start) < 0) {
                 return -1;
             }
-            dup2(fd, STDOUT_FILENO);
-            dup2(fd, STDERR_FILENO);
-            close(fd);
-            break;
-            
-        case REDIR_BOTH_APPEND:
-            fd = open(cmd->redir_file, O_WRONLY | O_CREAT | O_APPEND, 0644);
-            if (fd < 0) {
-                perror(cmd->redir_file);
+            line[end] = saved;
+            start = end;
+        }
+        
+        /* Le début de ligne restant passe en tête ; une ligne plus longue que
+         * le tampon le fait doubler */
+        memmove(line, line + start, len - start);
+        len -= start;
+        if (len == cap) {
+            char *grown = arena_grow(&line_arena, line, cap + 1, 2 * cap + 1);
+            if (grown == NULL) {
                 return -1;
             }
-            dup2(fd, STDOUT_FILENO);
-            dup2(fd, STDERR_FILENO);
-            close(fd);
-            break;
-            
-        default:
-            break;
+            line = grown;
+            cap *= 2;
+        }
+    }
+    if (len > 0 && here_append_expanded(&doc, line, len) < 0) {
+        return -1;
+    }
+    
+    redir->source = here_finish(&doc);
+    redir->expand = 0;
+    return redir->source >= 0 ? 0 : -1;
+}
+
+/* Ferme les documents de la ligne, une fois ses commandes lancées */
+void close_here_documents(void) {
+    for (int i = 0; i < here_count; i++) {
+        close(here_fds[i]);
+    }
+    here_count = 0;
+}
+
+/* Applique une redirection au processus courant */
+static int apply_redirection(redirection_t *redir) {
+    int targets[2];
+    int n;
+    int fd;
+    int kept = 0;
+    
+    if (redir->type == REDIR_CLOSE) {
+        close(redir->fd);
+        return 0;
+    }
+    if (redirection_copies_fd(redir)) {
+        if (dup2(redir->source, redir->fd) < 0) {
+            fprintf(stderr, "mysh: %d: %s\n", redir->source, strerror(errno));
+            return -1;
+        }
+        return 0;
+    }
+    
+    fd = open_redirection(redir);
+    if (fd < 0) {
+        return -1;
+    }
+    
+    n = redirection_targets(redir, targets);
+    for (int i = 0; i < n; i++) {
+        if (targets[i] == fd) {
+            /* Ouvert directement sur la cible : il doit survivre à l'exec */
+            fcntl(fd, F_SETFD, 0);
+            kept = 1;
+        } else {
+            dup2(fd, targets[i]);
+        }
+    }
+    if (!kept) {
+        close(fd);
     }
     
     return 0;
 }
 
-void restore_redirections(int saved_stdin, int saved_stdout, int saved_stderr) {
-    if (saved_stdin >= 0) {
-        dup2(saved_stdin, STDIN_FILENO);
-        close(saved_stdin);
+/* Applique toutes les redirections de cmd, dans le fils avant l'exec */
+int setup_redirections(command_t *cmd) {
+    for (redirection_t *redir = cmd->redirs; redir != NULL; redir = redir->next) {
+        if (apply_redirection(redir) < 0) {
+            return -1;
+        }
     }
-    if (saved_stdout >= 0) {
-        dup2(saved_stdout, STDOUT_FILENO);
-        close(saved_stdout);
+    return 0;
+}
+
+/* Met fd de côté dans saved (count entrées) s'il n'y est pas déjà */
+static void save_fd(saved_fd_t *saved, int *count, int fd) {
+    int flags;
+    
+    for (int i = 0; i < *count; i++) {
+        if (saved[i].fd == fd) {
+            return;
+        }
     }
-    if (saved_stderr >= 0) {
-        dup2(saved_stderr, STDERR_FILENO);
-        close(saved_stderr);
+    saved[*count].fd = fd;
+    saved[*count].copy = fcntl(fd, F_DUPFD_CLOEXEC, 10);
+    flags = fcntl(fd, F_GETFD);
+    saved[*count].cloexec = (flags >= 0 && (flags & FD_CLOEXEC));
+    (*count)++;
+    saved[*count].fd = -1;
+}
+
+/*
+ * Applique les redirections de cmd dans le shell lui-même, pour un builtin :
+ * chaque descripteur remplacé est d'abord mis de côté (F_DUPFD_CLOEXEC, au-delà
+ * de 10) dans le tableau renvoyé, que restore_redirections() remet en place.
+ * fd_in (-1 : aucun) devient l'entrée standard, avant les redirections de cmd.
+ * Renvoie NULL, tout étant rétabli, si une redirection échoue.
+ */
+saved_fd_t *redirect_in_shell(command_t *cmd, int fd_in) {
+    int n = 1;
+    int count = 0;
+    saved_fd_t *saved;
+    
+    for (redirection_t *redir = cmd->redirs; redir != NULL; redir = redir->next) {
+        n += 2;
+    }
+    saved = arena_alloc(&line_arena, sizeof(saved_fd_t) * (n + 1));
+    if (saved == NULL) {
+        return NULL;
+    }
+    saved[0].fd = -1;
+    
+    /* Ce que le shell a déjà écrit part vers l'ancienne destination */
+    fflush(stdout);
+    fflush(stderr);
+    
+    if (fd_in >= 0) {
+        save_fd(saved, &count, STDIN_FILENO);
+        dup2(fd_in, STDIN_FILENO);
+    }
+    
+    for (redirection_t *redir = cmd->redirs; redir != NULL; redir = redir->next) {
+        int targets[2];
+        int k = redirection_targets(redir, targets);
+        
+        for (int i = 0; i < k; i++) {
+            save_fd(saved, &count, targets[i]);
+        }
+        if (apply_redirection(redir) < 0) {
+            restore_redirections(saved);
+            return NULL;
+        }
+    }
+    
+    return saved;
+}
+
+/* Rétablit les descripteurs mis de côté par redirect_in_shell() */
+void restore_redirections(saved_fd_t *saved) {
+    int count = 0;
+    
+    fflush(stdout);
+    fflush(stderr);
+    
+    while (saved[count].fd >= 0) {
+        count++;
+    }
+    
+    for (int i = count - 1; i >= 0; i--) {
+        if (saved[i].copy >= 0) {
+            /* Un descripteur interne du shell (segment, signalfd) reste O_CLOEXEC */
+            dup3(saved[i].copy, saved[i].fd, saved[i].cloexec ? O_CLOEXEC : 0);
+            close(saved[i].copy);
+        } else {
+            close(saved[i].fd);
+        }
     }
 }
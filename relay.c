@@ -0,0 +1,215 @@
+#include "mysh.h"
+#include <poll.h>
+#include <sys/ioctl.h>
+
+/*
+ * Pipelines instrumentés (myopt pipestat=on) : au lieu d'un tube direct entre
+ * deux étapes, chaque étape écrit dans son propre tube et le shell recopie
+ * vers le tube de l'étape suivante par splice(), sans passer par l'espace
+ * utilisateur. Le relais compte les octets et le temps passé à attendre un
+ * amont vide ou un aval plein : l'étape qui fait attendre les autres est le
+ * goulot du pipeline.
+ */
+
+/* Période de vérification des étapes stoppées quand rien ne bouge */
+#define RELAY_POLL_MS 100
+
+/* Applique myopt pipesize au tube de fd ; un refus garde la capacité du noyau */
+void set_pipe_size(int fd) {
+    if (shell_opts.pipe_size > 0) {
+        fcntl(fd, F_SETPIPE_SZ, shell_opts.pipe_size);
+    }
+}
+
+static void close_relay(relay_t *relay) {
+    close(relay->in);
+    close(relay->out);
+    relay->in = relay->out = -1;
+    relay->end_ns = now_ns();
+    shell_stats.relay_pipes++;
+    shell_stats.relay_bytes += relay->bytes;
+}
+
+/*
+ * Fait avancer le relais tant que splice() transmet. Renvoie 0 quand il
+ * faut attendre (waiting_out dit quel côté), -1 une fois le relais fermé :
+ * fin de l'amont, ou aval disparu, que l'amont apprendra par EPIPE.
+ */
+static int pump_relay(relay_t *relay) {
+    while (1) {
+        ssize_t n = splice(relay->in, NULL, relay->out, NULL, relay->capacity,
+                           SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        int pending = 0;
+        
+        if (n > 0) {
+            relay->bytes += n;
+            continue;
+        }
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && errno == EAGAIN) {
+            /* Des données attendent en amont : c'est l'aval qui est plein */
+            ioctl(relay->in, FIONREAD, &pending);
+            relay->waiting_out = (pending > 0);
+            return 0;
+        }
+        close_relay(relay);
+        return -1;
+    }
+}
+
+/* Vrai si une étape a été stoppée (Ctrl-Z) : son statut reste à récolter */
+static int stage_stopped(pid_t *pids, int npids) {
+    for (int i = 0; i < npids; i++) {
+        siginfo_t info;
+        
+        if (pids[i] <= 0) {
+            continue;
+        }
+        info.si_pid = 0;
+        if (waitid(P_PID, pids[i], &info, WSTOPPED | WNOHANG | WNOWAIT) == 0 &&
+            info.si_pid != 0 && info.si_code == CLD_STOPPED) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Relaie les count tubes jusqu'à ce que tous soient fermés. Si une étape est
+ * stoppée, les relais s'arrêtent et les étapes restent reliées par des tubes
+ * fermés : le job repris finit sur EPIPE ou une fin de fichier.
+ */
+void run_relays(relay_t *relays, int count, pid_t *pids, int npids) {
+    struct pollfd *fds = arena_alloc(&line_arena, sizeof(struct pollfd) * count);
+    struct sigaction ignore;
+    struct sigaction saved;
+    int remaining = 0;
+    
+    /* Un relais sans tube (in < 0) laisse ses étapes reliées directement */
+    for (int i = 0; i < count; i++) {
+        if (relays[i].in >= 0) {
+            remaining++;
+        }
+    }
+    if (fds == NULL) {
+        for (int i = 0; i < count; i++) {
+            if (relays[i].in >= 0) {
+                close_relay(&relays[i]);
+            }
+        }
+        return;
+    }
+    
+    /* Un aval fermé doit donner EPIPE au relais, pas tuer le shell */
+    memset(&ignore, 0, sizeof(ignore));
+    ignore.sa_handler = SIG_IGN;
+    sigaction(SIGPIPE, &ignore, &saved);
+    
+    for (int i = 0; i < count; i++) {
+        if (relays[i].in >= 0) {
+            fcntl(relays[i].in, F_SETFL, O_NONBLOCK);
+            fcntl(relays[i].out, F_SETFL, O_NONBLOCK);
+        }
+    }
+    
+    while (remaining > 0) {
+        unsigned long long before;
+        unsigned long long waited;
+        int nfds = 0;
+        int ready;
+        
+        for (int i = 0; i < count; i++) {
+            relay_t *relay = &relays[i];
+            
+            if (relay->in < 0) {
+                continue;
+            }
+            if (pump_relay(relay) < 0) {
+                remaining--;
+                continue;
+            }
+            fds[nfds].fd = relay->waiting_out ? relay->out : relay->in;
+            fds[nfds].events = relay->waiting_out ? POLLOUT : POLLIN;
+            nfds++;
+        }
+        if (nfds == 0) {
+            break;
+        }
+        
+        before = now_ns();
+        ready = poll(fds, nfds, RELAY_POLL_MS);
+        waited = now_ns() - before;
+        
+        for (int i = 0; i < count; i++) {
+            if (relays[i].in < 0) {
+                continue;
+            }
+            if (relays[i].waiting_out) {
+                relays[i].full_ns += waited;
+            } else {
+                relays[i].empty_ns += waited;
+            }
+        }
+        
+        if (ready == 0 && stage_stopped(pids, npids)) {
+            for (int i = 0; i < count; i++) {
+                if (relays[i].in >= 0) {
+                    close_relay(&relays[i]);
+                }
+            }
+            break;
+        }
+    }
+    
+    sigaction(SIGPIPE, &saved, NULL);
+}
+
+static double seconds(unsigned long long ns) {
+    return ns / 1e9;
+}
+
+/*
+ * Rapport sur stderr : pour chaque tube le volume, le débit et les attentes
+ * du relais ; pour chaque étape, le temps où son entrée était vide et sa
+ * sortie pleine. L'étape qui attend le moins est le goulot probable.
+ */
+void print_relays(command_t *cmd, relay_t *relays, int count, unsigned long long start) {
+    unsigned long long total = now_ns() - start;
+    unsigned long long best = 0;
+    const char *bottleneck = NULL;
+    int bottleneck_stage = 0;
+    int stage = 0;
+    
+    fprintf(stderr, "pipestat : %d étapes en %.3f s, tubes de %d octets\n",
+            count + 1, seconds(total), relays[0].capacity);
+    
+    for (int i = 0; i < count; i++) {
+        unsigned long long active = relays[i].end_ns - start;
+        
+        if (relays[i].end_ns == 0) {
+            fprintf(stderr, "  tube %d : direct, non relayé\n", i + 1);
+            continue;
+        }
+        fprintf(stderr, "  tube %d : %llu octets, %.1f Mo/s, amont vide %.3f s, aval plein %.3f s\n",
+                i + 1, relays[i].bytes, active > 0 ? relays[i].bytes / (active / 1e3) : 0.0,
+                seconds(relays[i].empty_ns), seconds(relays[i].full_ns));
+    }
+    
+    for (command_t *current = cmd; current != NULL && stage <= count;
+         current = current->next, stage++) {
+        unsigned long long in = (stage > 0) ? relays[stage - 1].empty_ns : 0;
+        unsigned long long out = (stage < count) ? relays[stage].full_ns : 0;
+        
+        fprintf(stderr, "  étape %d %-12s : entrée vide %.3f s, sortie pleine %.3f s\n",
+                stage + 1, current->argv[0], seconds(in), seconds(out));
+        if (bottleneck == NULL || in + out < best) {
+            best = in + out;
+            bottleneck = current->argv[0];
+            bottleneck_stage = stage + 1;
+        }
+    }
+    
+    fprintf(stderr, "  goulot probable : étape %d (%s)\n", bottleneck_stage, bottleneck);
+}
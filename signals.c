@@ -1,13 +1,18 @@
 #include "mysh.h"
+#include <sys/signalfd.h>
 
-//Hnadlers de signaux
-void setup_signals(void) {
+/*
+ * SIGCHLD, SIGINT et SIGTSTP sont bloqués et lus par la boucle principale via
+ * signal_fd : les fins de jobs sont traitées dès qu'elles arrivent, hors de tout
+ * gestionnaire. Les gestionnaires ci-dessous ne servent que si signalfd échoue.
+ */
+static void install_handlers(void) {
     struct sigaction sa;
     
     /* SIGCHLD handler */
     sa.sa_handler = sigchld_handler;
     sigemptyset(&sa.sa_mask);
-    sa.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+    sa.sa_flags = SA_RESTART;
     sigaction(SIGCHLD, &sa, NULL);
     
     /* SIGINT handler */
@@ -23,23 +28,67 @@ void setup_signals(void) {
     sigaction(SIGTSTP, &sa, NULL);
 }
 
+void setup_signals(void) {
+    sigset_t set;
+    
+    sigemptyset(&set);
+    sigaddset(&set, SIGCHLD);
+    sigaddset(&set, SIGINT);
+    sigaddset(&set, SIGTSTP);
+    
+    sigprocmask(SIG_BLOCK, &set, NULL);
+    signal_fd = signalfd(-1, &set, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (signal_fd < 0) {
+        perror("signalfd");
+        sigprocmask(SIG_UNBLOCK, &set, NULL);
+        install_handlers();
+    }
+    
+    /* Reprendre le terminal après myfg ne doit pas stopper le shell */
+    sigemptyset(&set);
+    sigaddset(&set, SIGTTOU);
+    sigprocmask(SIG_BLOCK, &set, NULL);
+}
+
+/*
+ * Traite les signaux en attente sur signal_fd. Un SIGINT ou SIGTSTP reçu
+ * pendant une commande au premier plan visait celle-ci et est ignoré ;
+ * à l'invite, SIGINT demande confirmation avant de quitter.
+ * Renvoie le nombre de jobs signalés à l'utilisateur.
+ */
+int handle_signal_events(int at_prompt) {
+    struct signalfd_siginfo info;
+    int notified = 0;
+    int sigint = 0;
+    
+    if (signal_fd < 0) {
+        return 0;
+    }
+    
+    while (read(signal_fd, &info, sizeof(info)) == sizeof(info)) {
+        if (info.ssi_signo == SIGCHLD) {
+            notified += reap_children(at_prompt);
+        } else if (info.ssi_signo == SIGINT) {
+            sigint = 1;
+        }
+    }
+    
+    if (sigint && at_prompt) {
+        confirm_exit();
+    }
+    
+    return notified;
+}
+
 void sigchld_handler(int sig) {
     (void)sig;
     int saved_errno = errno;
     pid_t pid;
     int status;
     
-    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
-        job_t *job = get_job_by_pid(pid);
-        if (job != NULL) {
-            if (WIFEXITED(status)) {
-                job->status = WEXITSTATUS(status);
-                job->state = JOB_DONE;
-            } else if (WIFSIGNALED(status)) {
-                job->status = -1;
-                job->state = JOB_DONE;
-            }
-        }
+    /* Récolte seulement : les jobs sont mis à jour par check_background_jobs() */
+    while (job_event_room() && (pid = waitpid(-1, &status, WNOHANG | WUNTRACED)) > 0) {
+        job_event_push(pid, status);
     }
     
     errno = saved_errno;
@@ -54,26 +103,37 @@ void sigint_handler(int sig) {
         return;
     }
     
-    /* Otherwise, ask for confirmation to exit */
+    confirm_exit();
+}
+
+/* Demande confirmation puis quitte en tuant les jobs en arrière-plan */
+void confirm_exit(void) {
+    static int asking = 0;
+    char *response;
+    
+    if (asking) {
+        return;
+    }
+    asking = 1;
+    
     printf("\nVoulez-vous vraiment quitter? (o/n) ");
     fflush(stdout);
     
-    char response;
-    if (read(STDIN_FILENO, &response, 1) > 0) {
-        if (response == 'o' || response == 'O') {
-            /* Kill all background jobs */
-            job_t *current = job_list;
-            while (current != NULL) {
-                kill(current->pid, SIGKILL);
-                current = current->next;
+    response = read_line();
+    asking = 0;
+    
+    if (response != NULL && (response[0] == 'o' || response[0] == 'O')) {
+        /* Kill all background jobs */
+        for (int id = 1; id <= job_table.highest; id++) {
+            if (job_table.slots[id] != NULL) {
+                signal_job(job_table.slots[id], SIGKILL);
             }
-            
-            cleanup_shared_env();
-            exit(0);
         }
+        
+        cleanup_shared_env();
+        exit(0);
     }
     
-    printf("\n");
     print_prompt();
 }
 
@@ -85,3 +145,17 @@ void sigtstp_handler(int sig) {
         kill(foreground_pid, SIGTSTP);
     }
 }
+
+/* Bloque SIGCHLD le temps d'attendre un fils au premier plan :
+ * le gestionnaire ne doit pas récolter son statut avant waitpid */
+void block_sigchld(sigset_t *saved) {
+    sigset_t set;
+    
+    sigemptyset(&set);
+    sigaddset(&set, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &set, saved);
+}
+
+void restore_sigmask(sigset_t *saved) {
+    sigprocmask(SIG_SETMASK, saved, NULL);
+}
@@ -0,0 +1,337 @@
+#include "mysh.h"
+
+/*
+ * Moteur de création des processus externes.
+ * SPAWN_POSIX passe par posix_spawn (clone(CLONE_VM|CLONE_VFORK) dans la glibc) :
+ * aucune copie des tables de pages du shell, le parent reprend la main une fois
+ * l'exec effectué. SPAWN_FORK reste le chemin classique fork + execve, utilisé
+ * aussi pour les builtins qui doivent tourner dans un processus fils.
+ * Les deux passent l'environnement partagé (get_env_array), pas environ.
+ */
+
+static void record_spawn(spawn_mode_t mode, unsigned long long start) {
+    unsigned long long elapsed = now_ns() - start;
+    
+    shell_stats.spawn_count[mode]++;
+    shell_stats.spawn_ns[mode] += elapsed;
+    if (elapsed > shell_stats.spawn_max_ns[mode]) {
+        shell_stats.spawn_max_ns[mode] = elapsed;
+    }
+}
+
+/*
+ * Signaux que le shell capte ou ignore (SIGPIPE pendant mytee...) : le fils
+ * les reçoit avec leur action par défaut, quel que soit le moteur.
+ */
+static void child_default_signals(sigset_t *set) {
+    sigemptyset(set);
+    sigaddset(set, SIGINT);
+    sigaddset(set, SIGQUIT);
+    sigaddset(set, SIGTSTP);
+    sigaddset(set, SIGTTIN);
+    sigaddset(set, SIGTTOU);
+    sigaddset(set, SIGPIPE);
+    sigaddset(set, SIGCHLD);
+}
+
+/*
+ * Un builtin lancé dans un fils ne passe pas par exec : les extrémités de
+ * tubes O_CLOEXEC du shell (tube suivant du pipeline, relais) y restent
+ * ouvertes et empêcheraient la fin de fichier ou EPIPE. Elles sont fermées
+ * ici comme exec l'aurait fait ; le segment et signalfd sont gardés.
+ */
+static void close_cloexec_pipes(void) {
+    DIR *dir = opendir("/proc/self/fd");
+    struct dirent *entry;
+    
+    if (dir == NULL) {
+        return;
+    }
+    while ((entry = readdir(dir)) != NULL) {
+        int fd = atoi(entry->d_name);
+        int flags;
+        struct stat st;
+        
+        if (fd <= STDERR_FILENO || fd == dirfd(dir)) {
+            continue;
+        }
+        flags = fcntl(fd, F_GETFD);
+        if (flags >= 0 && (flags & FD_CLOEXEC) && fstat(fd, &st) == 0 && S_ISFIFO(st.st_mode)) {
+            close(fd);
+        }
+    }
+    closedir(dir);
+}
+
+/*
+ * Un fichier exécutable sans en-tête reconnu (ENOEXEC : script sans #!) est
+ * confié à /bin/sh, comme le faisait execvp : renvoie sh path arg1 ...
+ */
+static char **script_argv(command_t *cmd, const char *path) {
+    char **argv = arena_alloc(&line_arena, sizeof(char *) * (cmd->argc + 2));
+    
+    if (argv == NULL) {
+        return NULL;
+    }
+    argv[0] = "sh";
+    argv[1] = (char *)path;
+    for (int i = 1; i <= cmd->argc; i++) {
+        argv[i + 1] = cmd->argv[i];
+    }
+    return argv;
+}
+
+static pid_t spawn_fork(command_t *cmd, const char *path, char **envp, int fd_in, int fd_out,
+                        pid_t pgid, int *exec_err) {
+    unsigned long long start = now_ns();
+    int builtin = (path == NULL);
+    int exec_pipe[2] = { -1, -1 };
+    sigset_t mask;
+    int child_errno;
+    pid_t pid;
+    
+    /* Tube fermé par l'exec : le parent attend comme avec posix_spawn,
+     * la mesure couvre donc bien fork -> exec, et un échec de l'exec y
+     * remonte son errno */
+    if (!builtin && pipe2(exec_pipe, O_CLOEXEC) < 0) {
+        exec_pipe[0] = exec_pipe[1] = -1;
+    }
+    
+    pid = fork();
+    
+    if (pid < 0) {
+        perror("fork");
+        if (exec_pipe[0] >= 0) {
+            close(exec_pipe[0]);
+            close(exec_pipe[1]);
+        }
+        return -1;
+    }
+    
+    if (pid == 0) {
+        /* processus fils */
+        struct sigaction dfl;
+        
+        memset(&dfl, 0, sizeof(dfl));
+        dfl.sa_handler = SIG_DFL;
+        child_default_signals(&mask);
+        for (int sig = 1; sig < NSIG; sig++) {
+            if (sigismember(&mask, sig) == 1) {
+                sigaction(sig, &dfl, NULL);
+            }
+        }
+        sigemptyset(&mask);
+        sigprocmask(SIG_SETMASK, &mask, NULL);
+        
+        if (pgid >= 0) {
+            setpgid(0, pgid);
+        }
+        
+        if (fd_in >= 0) {
+            dup2(fd_in, STDIN_FILENO);
+            close(fd_in);
+        }
+        if (fd_out >= 0) {
+            dup2(fd_out, STDOUT_FILENO);
+            close(fd_out);
+        }
+        
+        if (setup_redirections(cmd) < 0) {
+            exit(1);
+        }
+        
+        if (builtin) {
+            close_cloexec_pipes();
+            exit(execute_builtin(cmd));
+        }
+        
+        execve(path, cmd->argv, envp);
+        child_errno = errno;
+        if (child_errno == ENOEXEC) {
+            char **argv = script_argv(cmd, path);
+            if (argv != NULL) {
+                execve("/bin/sh", argv, envp);
+            }
+        }
+        if (exec_pipe[1] >= 0) {
+            write(exec_pipe[1], &child_errno, sizeof(child_errno));
+        } else {
+            perror(cmd->argv[0]);
+        }
+        _exit(127);
+    }
+    
+    if (exec_pipe[0] >= 0) {
+        ssize_t n;
+        
+        close(exec_pipe[1]);
+        while ((n = read(exec_pipe[0], &child_errno, sizeof(child_errno))) < 0 && errno == EINTR) {
+        }
+        close(exec_pipe[0]);
+        
+        if (n == sizeof(child_errno)) {
+            waitpid(pid, NULL, 0);
+            *exec_err = child_errno;
+            return -1;
+        }
+    }
+    
+    record_spawn(SPAWN_FORK, start);
+    return pid;
+}
+
+static int count_redirections(command_t *cmd) {
+    int n = 0;
+    
+    for (redirection_t *redir = cmd->redirs; redir != NULL; redir = redir->next) {
+        n++;
+    }
+    return n;
+}
+
+static pid_t spawn_posix(command_t *cmd, const char *path, char **envp, int fd_in, int fd_out,
+                         pid_t pgid, int *exec_err) {
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    sigset_t mask;
+    short flags = POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF;
+    int nopened = 0;
+    int *opened = NULL;
+    int err = 0;
+    pid_t pid;
+    unsigned long long start = now_ns();
+    
+    posix_spawn_file_actions_init(&actions);
+    if (fd_in >= 0) {
+        posix_spawn_file_actions_adddup2(&actions, fd_in, STDIN_FILENO);
+    }
+    if (fd_out >= 0) {
+        posix_spawn_file_actions_adddup2(&actions, fd_out, STDOUT_FILENO);
+    }
+    
+    /* Les fichiers sont ouverts ici pour que l'erreur vise le bon nom ; les
+     * actions reprennent les redirections dans l'ordre de la ligne */
+    for (redirection_t *redir = cmd->redirs; redir != NULL; redir = redir->next) {
+        int targets[2];
+        int fd;
+        int n;
+        
+        if (redir->type == REDIR_CLOSE) {
+            posix_spawn_file_actions_addclose(&actions, redir->fd);
+            continue;
+        }
+        if (redirection_copies_fd(redir)) {
+            posix_spawn_file_actions_adddup2(&actions, redir->source, redir->fd);
+            continue;
+        }
+        
+        if (opened == NULL) {
+            opened = arena_alloc(&line_arena, sizeof(int) * count_redirections(cmd));
+            if (opened == NULL) {
+                err = -1;
+                break;
+            }
+        }
+        fd = open_redirection(redir);
+        if (fd < 0) {
+            err = -1;
+            break;
+        }
+        opened[nopened++] = fd;
+        n = redirection_targets(redir, targets);
+        for (int i = 0; i < n; i++) {
+            posix_spawn_file_actions_adddup2(&actions, fd, targets[i]);
+        }
+    }
+    if (err < 0) {
+        posix_spawn_file_actions_destroy(&actions);
+        for (int i = 0; i < nopened; i++) {
+            close(opened[i]);
+        }
+        *exec_err = 0;
+        return -1;
+    }
+    
+    posix_spawnattr_init(&attr);
+    sigemptyset(&mask);
+    posix_spawnattr_setsigmask(&attr, &mask);
+    child_default_signals(&mask);
+    posix_spawnattr_setsigdefault(&attr, &mask);
+    if (pgid >= 0) {
+        flags |= POSIX_SPAWN_SETPGROUP;
+        posix_spawnattr_setpgroup(&attr, pgid);
+    }
+    posix_spawnattr_setflags(&attr, flags);
+    
+    err = posix_spawn(&pid, path, &actions, &attr, cmd->argv, envp);
+    if (err == ENOEXEC) {
+        char **argv = script_argv(cmd, path);
+        if (argv != NULL) {
+            err = posix_spawn(&pid, "/bin/sh", &actions, &attr, argv, envp);
+        }
+    }
+    
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&actions);
+    for (int i = 0; i < nopened; i++) {
+        close(opened[i]);
+    }
+    
+    if (err != 0) {
+        *exec_err = err;
+        return -1;
+    }
+    
+    record_spawn(SPAWN_POSIX, start);
+    return pid;
+}
+
+/*
+ * Lance cmd avec fd_in/fd_out branchés sur stdin/stdout (-1 pour ne rien changer)
+ * et le place dans le groupe pgid (0 : nouveau groupe, -1 : celui du shell).
+ * En cas d'échec renvoie -1 et *err_status reçoit le code de retour à reporter.
+ */
+pid_t spawn_process(command_t *cmd, int fd_in, int fd_out, pid_t pgid, int *err_status) {
+    char *path;
+    char **envp;
+    int exec_err = 0;
+    pid_t pid;
+    
+    *err_status = 1;
+    
+    if (is_builtin(cmd->argv[0])) {
+        return spawn_fork(cmd, NULL, NULL, fd_in, fd_out, pgid, &exec_err);
+    }
+    envp = get_env_array();
+    
+    /* Un chemin mémorisé qui a disparu est oublié puis recherché une fois de plus */
+    for (int attempt = 0; attempt < 2; attempt++) {
+        path = find_command(cmd->argv[0]);
+        if (path == NULL) {
+            exec_err = ENOENT;
+            break;
+        }
+        
+        if (shell_opts.spawn_mode == SPAWN_POSIX) {
+            pid = spawn_posix(cmd, path, envp, fd_in, fd_out, pgid, &exec_err);
+        } else {
+            pid = spawn_fork(cmd, path, envp, fd_in, fd_out, pgid, &exec_err);
+        }
+        
+        if (pid >= 0) {
+            return pid;
+        }
+        if (exec_err != ENOENT || path == cmd->argv[0]) {
+            break;
+        }
+        forget_command(cmd->argv[0]);
+    }
+    
+    if (exec_err != 0) {
+        errno = exec_err;
+        perror(cmd->argv[0]);
+        *err_status = (exec_err == ENOENT) ? 127 : 126;
+    }
+    
+    return -1;
+}
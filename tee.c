@@ -0,0 +1,297 @@
+#include "mysh.h"
+
+/*
+ * mytee [-a] [fichier ...] : recopie l'entrée standard sur la sortie standard
+ * et dans chaque fichier. Quand l'entrée est un tube, les octets ne passent
+ * pas par l'espace utilisateur : tee() les duplique dans un tube
+ * intermédiaire par sortie, que splice() vide vers celle-ci, puis splice()
+ * les retire de l'entrée. Sinon, boucle read/write sur un grand tampon.
+ * Builtin, mytee tourne dans le shell, seul ou en dernière étape.
+ */
+
+#define TEE_BUFFER (1024 * 1024)
+
+typedef struct {
+    int fd;
+    const char *name;
+    int scratch[2];         /* tube intermédiaire du chemin tee/splice */
+    int copy;               /* splice() refusé (terminal...) : vidé par read/write */
+    int active;
+} tee_output_t;
+
+static volatile sig_atomic_t tee_interrupted = 0;
+
+static void tee_sigint(int sig) {
+    (void)sig;
+    tee_interrupted = 1;
+}
+
+/* Retire une sortie en erreur ; la sortie standard n'est pas fermée */
+static void drop_output(tee_output_t *out, int *active) {
+    if (errno != EPIPE) {
+        fprintf(stderr, "mytee: %s: %s\n", out->name, strerror(errno));
+    }
+    if (out->fd != STDOUT_FILENO) {
+        close(out->fd);
+    }
+    out->active = 0;
+    (*active)--;
+}
+
+/* Boucle de repli : lit de gros blocs et les écrit sur chaque sortie */
+static int tee_copy(tee_output_t *outs, int nouts, int active) {
+    char *buf = malloc(TEE_BUFFER);
+    int ret = 0;
+    
+    if (buf == NULL) {
+        perror("malloc");
+        return 1;
+    }
+    
+    while (active > 0 && !tee_interrupted) {
+        ssize_t n = read(STDIN_FILENO, buf, TEE_BUFFER);
+        
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            perror("mytee");
+            ret = 1;
+            break;
+        }
+        if (n == 0) {
+            break;
+        }
+        for (int i = 0; i < nouts; i++) {
+            if (outs[i].active && write_all(outs[i].fd, buf, n) < 0) {
+                drop_output(&outs[i], &active);
+                ret = 1;
+            }
+        }
+    }
+    
+    free(buf);
+    return ret;
+}
+
+/* Transmet len octets du tube intermédiaire de out vers sa sortie */
+static int drain_scratch(tee_output_t *out, size_t len) {
+    char buf[65536];
+    
+    while (len > 0) {
+        ssize_t n;
+        
+        if (!out->copy) {
+            n = splice(out->scratch[0], NULL, out->fd, NULL, len, SPLICE_F_MOVE);
+            if (n < 0 && errno == EINVAL) {
+                out->copy = 1;
+                continue;
+            }
+        } else {
+            n = read(out->scratch[0], buf, len < sizeof(buf) ? len : sizeof(buf));
+            if (n > 0 && write_all(out->fd, buf, n) < 0) {
+                n = -1;
+            }
+        }
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        len -= n;
+    }
+    return 0;
+}
+
+/*
+ * Chemin sans copie. Chaque tour duplique le contenu de l'entrée dans les
+ * tubes intermédiaires, aussi grands qu'elle, pour que tee() copie chaque
+ * fois la même longueur, puis le consomme par splice() vers /dev/null.
+ * Renvoie -1 si ce chemin n'est pas possible, avant d'avoir rien lu.
+ */
+static int tee_splice(tee_output_t *outs, int nouts, int active) {
+    int size = fcntl(STDIN_FILENO, F_GETPIPE_SZ);
+    int null_fd = -1;
+    int started = 0;
+    int failed = 0;
+    int ret = (size > 0) ? 0 : -1;
+    
+    for (int i = 0; i < nouts; i++) {
+        outs[i].scratch[0] = outs[i].scratch[1] = -1;
+    }
+    for (int i = 0; ret == 0 && i < nouts; i++) {
+        if (pipe2(outs[i].scratch, O_CLOEXEC) < 0 ||
+            fcntl(outs[i].scratch[1], F_SETPIPE_SZ, size) < size) {
+            ret = -1;
+            break;
+        }
+    }
+    if (ret == 0) {
+        null_fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+        if (null_fd < 0) {
+            ret = -1;
+        }
+    }
+    
+    while (ret == 0 && active > 0 && !tee_interrupted) {
+        ssize_t n = -1;
+        ssize_t left;
+        
+        for (int i = 0; i < nouts; i++) {
+            ssize_t got;
+            
+            if (!outs[i].active) {
+                continue;
+            }
+            do {
+                got = tee(STDIN_FILENO, outs[i].scratch[1], n < 0 ? (size_t)size : (size_t)n, 0);
+            } while (got < 0 && errno == EINTR && !tee_interrupted);
+            if (tee_interrupted) {
+                n = 0;
+                break;
+            }
+            if (got < 0 || (n >= 0 && got != n)) {
+                /* Avant toute lecture, le repli read/write reste possible */
+                ret = (got < 0 && !started) ? -1 : 1;
+                if (ret > 0) {
+                    fprintf(stderr, "mytee: tee: %s\n", got < 0 ? strerror(errno) : "copie partielle");
+                }
+                break;
+            }
+            n = got;
+            if (n == 0) {
+                break;
+            }
+        }
+        if (ret != 0 || n <= 0) {
+            break;
+        }
+        started = 1;
+        
+        for (int i = 0; i < nouts; i++) {
+            if (outs[i].active && drain_scratch(&outs[i], n) < 0) {
+                drop_output(&outs[i], &active);
+                /* Ce qui reste dans son tube intermédiaire est perdu */
+                close(outs[i].scratch[0]);
+                close(outs[i].scratch[1]);
+                outs[i].scratch[0] = outs[i].scratch[1] = -1;
+                failed = 1;
+            }
+        }
+        
+        for (left = n; left > 0; ) {
+            ssize_t done = splice(STDIN_FILENO, NULL, null_fd, NULL, left, SPLICE_F_MOVE);
+            if (done < 0 && errno == EINTR) {
+                continue;
+            }
+            if (done <= 0) {
+                perror("mytee: splice");
+                ret = 1;
+                break;
+            }
+            left -= done;
+        }
+        if (left > 0) {
+            break;
+        }
+    }
+    
+    if (null_fd >= 0) {
+        close(null_fd);
+    }
+    for (int i = 0; i < nouts; i++) {
+        if (outs[i].scratch[0] >= 0) {
+            close(outs[i].scratch[0]);
+            close(outs[i].scratch[1]);
+        }
+    }
+    return ret != 0 ? ret : failed;
+}
+
+int builtin_mytee(char **argv) {
+    struct sigaction sa, old_int, old_pipe;
+    sigset_t intmask, old_mask;
+    struct stat st;
+    tee_output_t *outs;
+    int append = 0;
+    int first = 1;
+    int nouts = 0;
+    int active;
+    int ret = 0;
+    int status;
+    
+    if (argv[1] != NULL && strcmp(argv[1], "-a") == 0) {
+        append = 1;
+        first = 2;
+    }
+    
+    for (int i = first; argv[i] != NULL; i++) {
+        nouts++;
+    }
+    outs = arena_alloc(&line_arena, sizeof(tee_output_t) * (nouts + 1));
+    nouts = 0;
+    if (outs == NULL) {
+        return 1;
+    }
+    outs[nouts].fd = STDOUT_FILENO;
+    outs[nouts].name = "stdout";
+    outs[nouts].copy = 0;
+    outs[nouts].active = 1;
+    nouts++;
+    
+    for (int i = first; argv[i] != NULL; i++) {
+        int fd = open(argv[i], O_WRONLY | O_CREAT | O_CLOEXEC | (append ? O_APPEND : O_TRUNC), 0644);
+        
+        if (fd < 0) {
+            perror(argv[i]);
+            ret = 1;
+            continue;
+        }
+        outs[nouts].fd = fd;
+        outs[nouts].name = argv[i];
+        outs[nouts].copy = 0;
+        outs[nouts].active = 1;
+        nouts++;
+    }
+    active = nouts;
+    
+    /* Une sortie fermée donne EPIPE, pas SIGPIPE qui tuerait le shell ;
+     * SIGINT, lu d'ordinaire par signalfd, doit couper une lecture bloquée */
+    tee_interrupted = 0;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = SIG_IGN;
+    sigaction(SIGPIPE, &sa, &old_pipe);
+    sa.sa_handler = tee_sigint;
+    sigaction(SIGINT, &sa, &old_int);
+    sigemptyset(&intmask);
+    sigaddset(&intmask, SIGINT);
+    sigprocmask(SIG_UNBLOCK, &intmask, &old_mask);
+    
+    status = -1;
+    if (fstat(STDIN_FILENO, &st) == 0 && S_ISFIFO(st.st_mode)) {
+        status = tee_splice(outs, nouts, active);
+        active = 0;
+        for (int i = 0; i < nouts; i++) {
+            active += outs[i].active;
+        }
+    }
+    if (status < 0) {
+        status = tee_copy(outs, nouts, active);
+    }
+    
+    sigprocmask(SIG_SETMASK, &old_mask, NULL);
+    sigaction(SIGINT, &old_int, NULL);
+    sigaction(SIGPIPE, &old_pipe, NULL);
+    
+    for (int i = 0; i < nouts; i++) {
+        if (outs[i].active && outs[i].fd != STDOUT_FILENO) {
+            close(outs[i].fd);
+        }
+    }
+    
+    if (tee_interrupted) {
+        return 130;
+    }
+    return (ret || status) ? 1 : 0;
+}
@@ -1,4 +1,5 @@
 #include "mysh.h"
+#include <poll.h>
 
 char *get_current_dir(void) {
     static char cwd[MAX_LINE];
@@ -44,6 +45,117 @@ void print_prompt(void) {
     fflush(stdout);
 }
 
+/* Tampon d'entrée de read_line : [input_start, input_end) reste à lire */
+static char *input_buf = NULL;
+static size_t input_size = 0;
+static size_t input_start = 0;
+static size_t input_end = 0;
+static int input_eof = 0;
+
+/*
+ * Attend que stdin soit lisible en surveillant aussi signal_fd : les fins de
+ * jobs sont annoncées immédiatement, sans attendre la prochaine commande.
+ * Renvoie 1 si des signaux ont été traités (le tampon a pu changer), 0 sinon.
+ */
+static int wait_for_input(void) {
+    struct pollfd fds[2];
+    int nfds = 1;
+    
+    fds[0].fd = STDIN_FILENO;
+    fds[0].events = POLLIN;
+    if (signal_fd >= 0) {
+        fds[1].fd = signal_fd;
+        fds[1].events = POLLIN;
+        nfds = 2;
+    }
+    
+    while (poll(fds, nfds, -1) < 0) {
+        if (errno != EINTR) {
+            return 0;
+        }
+    }
+    
+    if (nfds == 2 && (fds[1].revents & POLLIN)) {
+        if (handle_signal_events(1) > 0) {
+            print_prompt();
+        }
+        return 1;
+    }
+    
+    return 0;
+}
+
+/*
+ * Lit une ligne sur stdin sans le saut de ligne final ; NULL en fin de fichier.
+ * Le tampon double tant que la ligne n'est pas complète : la longueur d'une
+ * ligne n'est limitée que par la mémoire. La ligne rendue reste valable
+ * jusqu'au prochain appel.
+ */
+char *read_line(void) {
+    static char *line = NULL;
+    static size_t line_size = 0;
+    ssize_t n;
+    
+    while (1) {
+        char *newline = (input_end > input_start)
+                        ? memchr(input_buf + input_start, '\n', input_end - input_start) : NULL;
+        size_t len;
+        
+        if (newline != NULL || input_eof) {
+            len = (newline != NULL) ? (size_t)(newline - (input_buf + input_start))
+                                    : input_end - input_start;
+            if (len == 0 && newline == NULL) {
+                return NULL;
+            }
+            if (len + 1 > line_size) {
+                char *grown = realloc(line, len + 1);
+                if (grown == NULL) {
+                    perror("realloc");
+                    return NULL;
+                }
+                line = grown;
+                line_size = len + 1;
+            }
+            memcpy(line, input_buf + input_start, len);
+            line[len] = '\0';
+            input_start += len + (newline != NULL);
+            return line;
+        }
+        
+        /* Ramène le reste en tête du tampon, l'agrandit s'il est plein */
+        memmove(input_buf, input_buf + input_start, input_end - input_start);
+        input_end -= input_start;
+        input_start = 0;
+        
+        if (input_end == input_size) {
+            size_t new_size = input_size ? input_size * 2 : MAX_LINE;
+            char *grown = realloc(input_buf, new_size);
+            if (grown == NULL) {
+                perror("realloc");
+                return NULL;
+            }
+            input_buf = grown;
+            input_size = new_size;
+        }
+        
+        if (wait_for_input()) {
+            continue;
+        }
+        
+        n = read(STDIN_FILENO, input_buf + input_end, input_size - input_end);
+        if (n < 0) {
+            if (errno == EINTR || errno == EAGAIN) {
+                continue;
+            }
+            input_eof = 1;
+        } else if (n == 0) {
+            input_eof = 1;
+        } else {
+            input_end += n;
+        }
+    }
+}
+
 char *trim_whitespace(char *str) {
     char *end;
     
@@ -64,3 +176,26 @@ char *trim_whitespace(char *str) {
     
     return str;
 }
+
+unsigned long long now_ns(void) {
+    struct timespec ts;
+    
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Écrit len octets en reprenant les écritures partielles ; -1 et errno si erreur */
+int write_all(int fd, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
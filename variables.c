@@ -1,335 +1,1403 @@
 #include "mysh.h"
 
 
-void lock_read_env(void) {
-    if (shared_env == NULL) return;
+/*
+ * Environnement partagé. Le segment commence par l'en-tête shared_env_t ;
+ * data contient d'abord l'index, une table de hachage à adressage ouvert de
+ * index_slots cases, puis le tas des entrées. Une case vaut le décalage de
+ * son entrée dans data, 0 si elle est vide, ENV_TOMBSTONE si l'entrée a été
+ * supprimée. Les blocs du tas sont pris par classes de taille (puissances de
+ * 2 à partir de ENV_MIN_BLOCK) ; un bloc libéré rejoint la liste libre de sa
+ * classe et resservira tel quel : rien n'est jamais décalé. La plus grande
+ * classe est la moitié de ENV_MAX_SIZE : une variable, nom et en-tête
+ * compris, ne dépasse pas 512 Mo.
+ *
+ * Le segment est un objet POSIX (shm_open) qui grandit à la demande : quand
+ * une variable n'y tient plus, l'écrivain double sa taille, y recopie les
+ * variables et incrémente generation. Chaque shell compare generation à
+ * celle de sa projection et se reprojette avant de lire ou d'écrire. Chaque
+ * shell tient un verrou partagé sur l'objet : celui qui obtient le verrou
+ * exclusif est seul, il le remet à neuf au lancement et le supprime en sortant.
+ *
+ * Les écrivains se succèdent sous write_lock, un mutex robuste : si un shell
+ * meurt en le tenant, le suivant le récupère. Chaque écriture terminée
+ * incrémente changes et réveille par futex les shells qui l'attendent
+ * (mywaitenv) ; les caches locaux (table des commandes, envp) s'y
+ * comparent. Les lecteurs ne prennent aucun verrou (seqlock) : seq est
+ * impair pendant une écriture, un lecteur note seq avant de lire, vérifie
+ * après qu'il n'a pas bougé et recommence sinon. Une lecture concurrente
+ * d'une écriture peut voir des décalages incohérents : tout ce qui est lu
+ * est borné par la taille projetée avant d'être suivi.
+ */
+
+#define ENV_SHM_NAME "/mysh_env"
+#define ENV_INITIAL_SIZE 65536
+#define ENV_MAX_SIZE (1u << ENV_MAX_SHIFT)
+#define ENV_MIN_BLOCK (1u << ENV_MIN_SHIFT)
+#define ENV_TOMBSTONE 0xffffffffu
+#define ENV_TOO_BIG (-2)            /* env_store() : aucune classe assez grande */
+#define ENV_ALIGN 8
+
+static int env_fd = -1;
+static pid_t env_owner = -1;
+static size_t env_mapped = 0;           /* taille de la projection locale */
+static uint32_t env_limit = 0;          /* octets de data projetés */
+static unsigned int env_generation = 0;
+
+/* Projette size octets de l'objet à la place de la projection courante */
+static int env_map(size_t size) {
+    void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, env_fd, 0);
     
-    sem_wait(&shared_env->mutex);
-    if (shared_env->writers_waiting > 0) {
-        sem_post(&shared_env->mutex);
-        sem_wait(&shared_env->writers_sem);
-    } else {
-        shared_env->readers_count++;
-        if (shared_env->readers_count == 1) {
-            sem_wait(&shared_env->readers_sem);
-        }
-        sem_post(&shared_env->mutex);
+    if (map == MAP_FAILED) {
+        perror("mmap");
+        return -1;
+    }
+    if (shared_env != NULL) {
+        munmap(shared_env, env_mapped);
     }
+    shared_env = map;
+    env_mapped = size;
+    env_limit = size - sizeof(shared_env_t);
+    return 0;
 }
 
-void unlock_read_env(void) {
-    if (shared_env == NULL) return;
+/* Suit un agrandissement fait par un autre shell */
+static void env_follow(void) {
+    unsigned int generation = atomic_load_explicit(&shared_env->generation, memory_order_acquire);
     
-    sem_wait(&shared_env->mutex);
-    shared_env->readers_count--;
-    if (shared_env->readers_count == 0) {
-        sem_post(&shared_env->readers_sem);
+    if (generation != env_generation &&
+        env_map(atomic_load(&shared_env->map_size)) == 0) {
+        env_generation = generation;
+        shell_stats.env_remaps++;
     }
-    sem_post(&shared_env->mutex);
 }
 
 void lock_write_env(void) {
     if (shared_env == NULL) return;
     
-    sem_wait(&shared_env->mutex);
-    shared_env->writers_waiting++;
-    sem_post(&shared_env->mutex);
-    
-    sem_wait(&shared_env->readers_sem);
-    sem_wait(&shared_env->writers_sem);
+    if (pthread_mutex_lock(&shared_env->write_lock) == EOWNERDEAD) {
+        /* L'écrivain précédent est mort verrou tenu : seq est remis pair */
+        pthread_mutex_consistent(&shared_env->write_lock);
+        if (atomic_load(&shared_env->seq) & 1) {
+            atomic_fetch_add(&shared_env->seq, 1);
+        }
+    }
+    env_follow();
     
-    sem_wait(&shared_env->mutex);
-    shared_env->writers_waiting--;
-    sem_post(&shared_env->mutex);
+    atomic_fetch_add_explicit(&shared_env->seq, 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
 }
 
 void unlock_write_env(void) {
     if (shared_env == NULL) return;
     
-    sem_post(&shared_env->writers_sem);
-    sem_post(&shared_env->readers_sem);
+    atomic_fetch_add_explicit(&shared_env->seq, 1, memory_order_release);
+    pthread_mutex_unlock(&shared_env->write_lock);
+    
+    /* Pas d'appel système si personne n'attend */
+    atomic_fetch_add(&shared_env->changes, 1);
+    if (atomic_load(&shared_env->waiters) > 0) {
+        syscall(SYS_futex, &shared_env->changes, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+    }
 }
 
-int init_shared_env(char **envp) {
-    key_t key = ftok("/tmp", 'M');
-    int created = 0;
+/* Nombre d'écritures faites dans l'environnement partagé, tous shells confondus */
+unsigned int env_changes(void) {
+    if (shared_env == NULL) {
+        return 0;
+    }
+    return atomic_load_explicit(&shared_env->changes, memory_order_acquire);
+}
+
+/*
+ * Dort jusqu'à ce que changes ne vaille plus seen, au plus timeout (NULL :
+ * sans limite). Renvoie -1 avec errno à ETIMEDOUT ou EINTR.
+ */
+static int env_wait_change(unsigned int seen, const struct timespec *timeout) {
+    int ret = 0;
+    
+    atomic_fetch_add(&shared_env->waiters, 1);
+    if (atomic_load(&shared_env->changes) == seen &&
+        syscall(SYS_futex, &shared_env->changes, FUTEX_WAIT, seen, timeout, NULL, 0) < 0 &&
+        errno != EAGAIN) {
+        ret = -1;
+    }
+    atomic_fetch_sub(&shared_env->waiters, 1);
+    return ret;
+}
+
+/* Début d'une lecture : attend la fin d'une écriture en cours, suit un agrandissement */
+static unsigned int env_read_begin(void) {
+    unsigned int seq;
+    
+    shell_stats.env_reads++;
+    while (1) {
+        seq = atomic_load_explicit(&shared_env->seq, memory_order_acquire);
+        if (seq & 1) {
+            sched_yield();
+        } else if (atomic_load_explicit(&shared_env->generation, memory_order_relaxed) != env_generation) {
+            env_follow();
+        } else {
+            return seq;
+        }
+    }
+}
+
+/* Fin d'une lecture : vrai si une écriture l'a croisée et qu'il faut la refaire */
+static int env_read_retry(unsigned int seq) {
+    atomic_thread_fence(memory_order_acquire);
+    if (atomic_load_explicit(&shared_env->seq, memory_order_relaxed) != seq) {
+        shell_stats.env_retries++;
+        return 1;
+    }
+    return 0;
+}
+
+static uint32_t env_hash(const char *name, size_t len) {
+    uint32_t h = 2166136261u;
+    
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)name[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static uint32_t *env_index(void) {
+    return (uint32_t *)shared_env->data;
+}
+
+static env_entry_t *env_entry(uint32_t offset) {
+    return (env_entry_t *)(shared_env->data + offset);
+}
+
+static int size_class(size_t size) {
+    int k = 0;
+    
+    while (k < ENV_CLASSES && ((size_t)ENV_MIN_BLOCK << k) < size) {
+        k++;
+    }
+    return k < ENV_CLASSES ? k : -1;
+}
+
+/* Bloc d'au moins size octets, 0 si le segment est plein */
+static uint32_t env_alloc(size_t size) {
+    int k = size_class(size);
+    uint32_t block;
+    
+    if (k < 0) {
+        return 0;
+    }
+    
+    block = shared_env->free_lists[k];
+    if (block != 0) {
+        shared_env->free_lists[k] = env_entry(block)->hash;
+        return block;
+    }
+    
+    if (shared_env->heap_used + ((size_t)ENV_MIN_BLOCK << k) > shared_env->data_size) {
+        return 0;
+    }
+    block = shared_env->heap_used;
+    shared_env->heap_used += ENV_MIN_BLOCK << k;
+    env_entry(block)->size = ENV_MIN_BLOCK << k;
+    return block;
+}
+
+static void env_free(uint32_t block) {
+    env_entry_t *entry = env_entry(block);
+    int k = size_class(entry->size);
     
-    shmid = shmget(key, SHM_SIZE, 0666);
+    entry->hash = shared_env->free_lists[k];
+    shared_env->free_lists[k] = block;
+}
+
+/*
+ * Case de l'index qui contient name, -1 s'il est absent. Si insert n'est pas
+ * NULL, il reçoit la première case réutilisable du chemin de sondage.
+ */
+static long env_find(const char *name, size_t len, uint32_t hash, long *insert) {
+    uint32_t *index = env_index();
+    uint32_t mask = shared_env->index_slots - 1;
+    uint32_t i = hash & mask;
     
-    if (shmid < 0) {
-        shmid = shmget(key, SHM_SIZE, IPC_CREAT | 0666);
-        if (shmid < 0) {
-            perror("shmget");
+    if (insert != NULL) {
+        *insert = -1;
+    }
+    
+    for (uint32_t n = 0; n < shared_env->index_slots && i < env_limit / sizeof(uint32_t);
+         n++, i = (i + 1) & mask) {
+        env_entry_t *entry;
+        
+        if (index[i] == 0 || index[i] == ENV_TOMBSTONE) {
+            if (insert != NULL && *insert < 0) {
+                *insert = i;
+            }
+            if (index[i] == 0) {
+                return -1;
+            }
+            continue;
+        }
+        
+        /* Un lecteur peut croiser une écriture : décalage à vérifier */
+        if (index[i] > env_limit - sizeof(env_entry_t)) {
             return -1;
         }
-        created = 1;
+        entry = env_entry(index[i]);
+        if (entry->hash == hash && entry->name_len == len &&
+            entry->size <= env_limit - index[i] &&
+            sizeof(env_entry_t) + len + 2 + entry->value_len <= entry->size &&
+            memcmp(entry->text, name, len) == 0) {
+            return i;
+        }
     }
+    return -1;
+}
+
+/* Reconstruit l'index sans ses pierres tombales */
+static int env_rebuild_index(void) {
+    uint32_t *index = env_index();
+    uint32_t *live = malloc(sizeof(uint32_t) * (shared_env->count + 1));
+    uint32_t n = 0;
     
-    shared_env = (shared_env_t *)shmat(shmid, NULL, 0);
-    if (shared_env == (void *)-1) {
-        perror("shmat");
+    if (live == NULL) {
+        perror("malloc");
         return -1;
     }
     
-    if (created) {
-        shared_env->initialized = 1;
-        shared_env->ref_count = 1;
-        shared_env->readers_count = 0;
-        shared_env->writers_waiting = 0;
+    for (uint32_t i = 0; i < shared_env->index_slots; i++) {
+        if (index[i] != 0 && index[i] != ENV_TOMBSTONE) {
+            live[n++] = index[i];
+        }
+    }
+    memset(index, 0, sizeof(uint32_t) * shared_env->index_slots);
+    
+    for (uint32_t k = 0; k < n; k++) {
+        uint32_t i = env_entry(live[k])->hash & (shared_env->index_slots - 1);
+        while (index[i] != 0) {
+            i = (i + 1) & (shared_env->index_slots - 1);
+        }
+        index[i] = live[k];
+    }
+    shared_env->tombstones = 0;
+    
+    free(live);
+    return 0;
+}
+
+static void env_fill(uint32_t block, const char *name, size_t len, uint32_t hash, const char *value) {
+    env_entry_t *entry = env_entry(block);
+    size_t value_len = strlen(value);
+    
+    entry->hash = hash;
+    entry->name_len = len;
+    entry->value_len = value_len;
+    memcpy(entry->text, name, len);
+    entry->text[len] = '=';
+    memcpy(entry->text + len + 1, value, value_len + 1);
+}
+
+/*
+ * Ajoute ou remplace name (len octets) ; à appeler sous le verrou d'écriture.
+ * Renvoie -1 si le segment est plein, ENV_TOO_BIG si aucune classe ne peut
+ * contenir la variable, même dans un objet agrandi.
+ */
+static int env_store(const char *name, size_t len, const char *value) {
+    uint32_t hash = env_hash(name, len);
+    size_t need = sizeof(env_entry_t) + len + strlen(value) + 2;
+    uint32_t *index = env_index();
+    long insert;
+    long slot;
+    uint32_t block;
+    
+    if (size_class(need) < 0) {
+        return ENV_TOO_BIG;
+    }
+    
+    slot = env_find(name, len, hash, &insert);
+    if (slot >= 0) {
+        uint32_t old = index[slot];
         
-        sem_init(&shared_env->readers_sem, 1, 1);
-        sem_init(&shared_env->writers_sem, 1, 1);
-        sem_init(&shared_env->mutex, 1, 1);
-        shared_env->data[0] = '\0';
-        int offset = 0;
-        for (int i = 0; envp[i] != NULL; i++) {
-            int len = strlen(envp[i]);
-            if (offset + len + 1 < SHM_SIZE - 256) {
-                strcpy(shared_env->data + offset, envp[i]);
-                offset += len + 1;
-            }
+        /* La nouvelle valeur tient dans le bloc : rien à déplacer */
+        if (need <= env_entry(old)->size) {
+            env_fill(old, name, len, hash, value);
+            return 0;
+        }
+        block = env_alloc(need);
+        if (block == 0) {
+            return -1;
         }
-        shared_env->data[offset] = '\0';
-        shared_env->data[offset + 1] = '\0';
-    } else {
-        lock_write_env();
-        shared_env->ref_count++;
-        unlock_write_env();
+        env_fill(block, name, len, hash, value);
+        index[slot] = block;
+        env_free(old);
+        return 0;
+    }
+    
+    /* Au plus 3/4 de l'index occupé, pierres tombales comprises */
+    if ((shared_env->count + shared_env->tombstones + 1) * 4 > shared_env->index_slots * 3) {
+        if (shared_env->tombstones == 0 || env_rebuild_index() < 0) {
+            return -1;
+        }
+        env_find(name, len, hash, &insert);
+    }
+    if (insert < 0 || (shared_env->count + 1) * 4 > shared_env->index_slots * 3) {
+        return -1;
     }
     
+    block = env_alloc(need);
+    if (block == 0) {
+        return -1;
+    }
+    env_fill(block, name, len, hash, value);
+    if (index[insert] == ENV_TOMBSTONE) {
+        shared_env->tombstones--;
+    }
+    index[insert] = block;
+    shared_env->count++;
     return 0;
 }
 
-void cleanup_shared_env(void) {
-    if (shared_env == NULL) {
+static void env_remove(const char *name) {
+    size_t len = strlen(name);
+    long slot = env_find(name, len, env_hash(name, len), NULL);
+    
+    if (slot < 0) {
         return;
     }
+    env_free(env_index()[slot]);
+    env_index()[slot] = ENV_TOMBSTONE;
+    shared_env->count--;
+    shared_env->tombstones++;
+}
+
+/* Découpe data pour un objet de size octets : une case d'index pour 64 octets */
+static void env_format(size_t size) {
+    uint32_t slots = 1;
     
-    lock_write_env();
-    shared_env->ref_count--;
-    int should_destroy = (shared_env->ref_count == 0);
-    unlock_write_env();
+    shared_env->data_size = size - sizeof(shared_env_t);
+    while (slots < shared_env->data_size / 64) {
+        slots *= 2;
+    }
+    shared_env->index_slots = slots;
+    shared_env->count = 0;
+    shared_env->tombstones = 0;
+    shared_env->heap_used = (slots * sizeof(uint32_t) + ENV_ALIGN - 1) & ~(uint32_t)(ENV_ALIGN - 1);
+    memset(shared_env->free_lists, 0, sizeof(shared_env->free_lists));
+    memset(env_index(), 0, slots * sizeof(uint32_t));
+}
+
+/*
+ * Double l'objet et y recopie les variables, sans trous ni pierres tombales ;
+ * à appeler sous le verrou d'écriture.
+ */
+static int env_grow(void) {
+    size_t size = (size_t)atomic_load(&shared_env->map_size) * 2;
+    uint32_t slots = shared_env->index_slots;
+    uint32_t used = shared_env->heap_used;
+    char *old;
     
-    if (should_destroy) {
-        sem_destroy(&shared_env->readers_sem);
-        sem_destroy(&shared_env->writers_sem);
-        sem_destroy(&shared_env->mutex);
-        
-        shmdt(shared_env);
-        shmctl(shmid, IPC_RMID, NULL);
-    } else {
-        shmdt(shared_env);
+    if (size > ENV_MAX_SIZE) {
+        return -1;
     }
     
-    shared_env = NULL;
+    old = malloc(used);
+    if (old == NULL) {
+        perror("malloc");
+        return -1;
+    }
+    memcpy(old, shared_env->data, used);
+    
+    if (ftruncate(env_fd, size) < 0) {
+        perror("ftruncate");
+        free(old);
+        return -1;
+    }
+    if (env_map(size) < 0) {
+        free(old);
+        return -1;
+    }
+    
+    env_format(size);
+    for (uint32_t i = 0; i < slots; i++) {
+        uint32_t offset = ((uint32_t *)old)[i];
+        if (offset != 0 && offset != ENV_TOMBSTONE) {
+            env_entry_t *entry = (env_entry_t *)(old + offset);
+            env_store(entry->text, entry->name_len, entry->text + entry->name_len + 1);
+        }
+    }
+    free(old);
+    
+    atomic_store(&shared_env->map_size, size);
+    env_generation = atomic_fetch_add_explicit(&shared_env->generation, 1, memory_order_release) + 1;
+    return 0;
 }
 
-char *get_variable(char *name) {
-    variable_t *var = local_vars;
-    while (var != NULL) {
-        if (strcmp(var->name, name) == 0) {
-            return var->value;
+/*
+ * env_store(), en agrandissant l'objet tant que la variable n'y tient pas.
+ * S'arrête dès qu'un agrandissement ne libère pas plus de place dans le tas :
+ * le suivant n'y changerait rien.
+ */
+static int env_store_growing(const char *name, size_t len, const char *value) {
+    int ret;
+    
+    while ((ret = env_store(name, len, value)) == -1) {
+        uint32_t room = shared_env->data_size - shared_env->heap_used;
+        
+        if (env_grow() < 0 || shared_env->data_size - shared_env->heap_used <= room) {
+            return -1;
         }
-        var = var->next;
     }
+    return ret;
+}
 
-    lock_read_env();
+/* Premier shell : objet remis à zéro puis rempli avec envp */
+static int env_create(char **envp) {
+    pthread_mutexattr_t attr;
+    int dropped = 0;
     
-    int offset = 0;
-    while (shared_env->data[offset] != '\0' || shared_env->data[offset + 1] != '\0') {
-        char *entry = shared_env->data + offset;
-        char *eq = strchr(entry, '=');
-        
-        if (eq != NULL) {
-            int name_len = eq - entry;
-            if (strncmp(entry, name, name_len) == 0 && name[name_len] == '\0') {
-                static char value[MAX_VAR_VALUE];
-                strcpy(value, eq + 1);
-                unlock_read_env();
-                return value;
-            }
+    if (ftruncate(env_fd, 0) < 0 || ftruncate(env_fd, ENV_INITIAL_SIZE) < 0) {
+        perror("ftruncate");
+        return -1;
+    }
+    if (env_map(ENV_INITIAL_SIZE) < 0) {
+        return -1;
+    }
+    
+    atomic_init(&shared_env->seq, 0);
+    atomic_init(&shared_env->generation, 0);
+    atomic_init(&shared_env->map_size, ENV_INITIAL_SIZE);
+    atomic_init(&shared_env->changes, 0);
+    atomic_init(&shared_env->waiters, 0);
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(&shared_env->write_lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+    env_format(ENV_INITIAL_SIZE);
+    
+    for (int i = 0; envp[i] != NULL; i++) {
+        char *eq = strchr(envp[i], '=');
+        if (eq != NULL && env_store_growing(envp[i], eq - envp[i], eq + 1) < 0) {
+            dropped++;
         }
-        
-        offset += strlen(entry) + 1;
+    }
+    if (dropped > 0) {
+        fprintf(stderr, "mysh: environnement partagé plein, %d variables ignorées\n", dropped);
+    }
+    
+    env_generation = atomic_load(&shared_env->generation);
+    shared_env->version = ENV_VERSION;
+    shared_env->magic = ENV_MAGIC;
+    return 0;
+}
+
+int init_shared_env(char **envp) {
+    struct flock lock = { .l_type = F_WRLCK, .l_whence = SEEK_SET };
+    
+    env_fd = shm_open(ENV_SHM_NAME, O_RDWR | O_CREAT, 0666);
+    if (env_fd < 0) {
+        perror("shm_open");
+        return -1;
+    }
+    env_owner = getpid();
+    
+    /* Verrou exclusif obtenu : aucun autre shell ne s'en sert, il est remis à neuf */
+    if (fcntl(env_fd, F_OFD_SETLK, &lock) == 0 && env_create(envp) < 0) {
+        return -1;
+    }
+    
+    /* Verrou partagé gardé jusqu'à la sortie ; attend qu'un créateur ait fini */
+    lock.l_type = F_RDLCK;
+    if (fcntl(env_fd, F_OFD_SETLKW, &lock) < 0) {
+        perror("fcntl");
+        return -1;
+    }
+    
+    if (shared_env == NULL) {
+        if (env_map(ENV_INITIAL_SIZE) < 0) {
+            return -1;
+        }
+        if (shared_env->magic != ENV_MAGIC || shared_env->version != ENV_VERSION) {
+            fprintf(stderr, "mysh: segment d'environnement d'une autre version de mysh\n");
+            return -1;
+        }
+        env_generation = atomic_load_explicit(&shared_env->generation, memory_order_acquire);
+        if (atomic_load(&shared_env->map_size) != env_mapped &&
+            env_map(atomic_load(&shared_env->map_size)) < 0) {
+            return -1;
+        }
+    }
+    
+    return 0;
+}
+
+void cleanup_shared_env(void) {
+    struct flock lock = { .l_type = F_WRLCK, .l_whence = SEEK_SET };
+    
+    if (shared_env == NULL) {
+        return;
     }
     
-    unlock_read_env();
+    /* Seul le shell lui-même, pas un fils, peut supprimer l'objet s'il est le dernier */
+    if (getpid() == env_owner && fcntl(env_fd, F_OFD_SETLK, &lock) == 0) {
+        pthread_mutex_destroy(&shared_env->write_lock);
+        shm_unlink(ENV_SHM_NAME);
+    }
     
+    munmap(shared_env, env_mapped);
+    close(env_fd);
+    shared_env = NULL;
+    env_fd = -1;
+}
+
+/*
+ * Variables locales. Chaque nom est interné une fois dans une table de
+ * hachage et porte directement sa liaison visible : une lecture ne coûte
+ * qu'un calcul de hachage et une comparaison. Les liaisons sont rangées par
+ * cadres (push_variable_frame) : une liaison d'un cadre intérieur masque
+ * celle du même nom plus bas, qui reparaît quand le cadre est retiré. Une
+ * valeur réécrite reprend son tampon s'il est assez grand, et unset le garde.
+ */
+
+#define NAMES_INITIAL_BUCKETS 64
+
+static var_name_t **name_buckets = NULL;
+static uint32_t name_bucket_count = 0;
+static uint32_t name_count = 0;
+
+static variable_t **frames = NULL;      /* liaisons créées dans chaque cadre */
+static int frame_depth = 0;
+static int frame_cap = 0;
+
+/* Nom interné de name (len octets, pas forcément terminé par '\0') */
+static var_name_t *intern_find(const char *name, size_t len, uint32_t hash) {
+    var_name_t *n;
+    
+    if (name_bucket_count == 0) {
+        return NULL;
+    }
+    for (n = name_buckets[hash & (name_bucket_count - 1)]; n != NULL; n = n->next) {
+        if (n->hash == hash && strncmp(n->text, name, len) == 0 && n->text[len] == '\0') {
+            return n;
+        }
+    }
     return NULL;
 }
 
-void set_local_variable(char *name, char *value) {
-    variable_t *var = local_vars;
-    while (var != NULL) {
-        if (strcmp(var->name, name) == 0) {
-            free(var->value);
-            var->value = strdup(value);
-            return;
+static void grow_names(void) {
+    uint32_t count = name_bucket_count ? name_bucket_count * 2 : NAMES_INITIAL_BUCKETS;
+    var_name_t **grown = calloc(count, sizeof(var_name_t *));
+    
+    if (grown == NULL) {
+        return;
+    }
+    for (uint32_t i = 0; i < name_bucket_count; i++) {
+        var_name_t *n = name_buckets[i];
+        while (n != NULL) {
+            var_name_t *next = n->next;
+            n->next = grown[n->hash & (count - 1)];
+            grown[n->hash & (count - 1)] = n;
+            n = next;
         }
-        var = var->next;
     }
+    free(name_buckets);
+    name_buckets = grown;
+    name_bucket_count = count;
+}
+
+static var_name_t *intern_name(const char *name) {
+    size_t len = strlen(name);
+    uint32_t hash = env_hash(name, len);
+    var_name_t *n = intern_find(name, len, hash);
     
-    var = malloc(sizeof(variable_t));
-    if (var == NULL) {
+    if (n != NULL) {
+        return n;
+    }
+    if (name_count >= name_bucket_count) {
+        grow_names();
+        if (name_bucket_count == 0) {
+            perror("calloc");
+            return NULL;
+        }
+    }
+    
+    n = malloc(sizeof(var_name_t));
+    if (n == NULL || (n->text = strdup(name)) == NULL) {
+        free(n);
         perror("malloc");
-        return;
+        return NULL;
     }
+    n->hash = hash;
+    n->binding = NULL;
+    n->next = name_buckets[hash & (name_bucket_count - 1)];
+    name_buckets[hash & (name_bucket_count - 1)] = n;
+    name_count++;
+    return n;
+}
+
+/* Liaison visible de n : la plus intérieure qui n'a pas été supprimée */
+static variable_t *find_local(var_name_t *n) {
+    variable_t *var = (n != NULL) ? n->binding : NULL;
     
-    var->name = strdup(name);
-    var->value = strdup(value);
-    var->next = local_vars;
-    local_vars = var;
+    while (var != NULL && !var->defined) {
+        var = var->shadowed;
+    }
+    return var;
 }
 
-void unset_local_variable(char *name) {
-    variable_t *prev = NULL;
-    variable_t *var = local_vars;
+/* Nouvelle liaison de n dans le cadre courant */
+static variable_t *bind_local(var_name_t *n) {
+    variable_t *var;
     
-    while (var != NULL) {
-        if (strcmp(var->name, name) == 0) {
-            if (prev == NULL) {
-                local_vars = var->next;
-            } else {
-                prev->next = var->next;
-            }
-            
-            free(var->name);
-            free(var->value);
-            free(var);
-            return;
+    if (frames == NULL) {
+        frames = calloc(1, sizeof(variable_t *));
+        if (frames == NULL) {
+            perror("calloc");
+            return NULL;
         }
+        frame_cap = 1;
+    }
+    
+    var = calloc(1, sizeof(variable_t));
+    if (var == NULL) {
+        perror("calloc");
+        return NULL;
+    }
+    var->name = n;
+    var->frame = frame_depth;
+    var->shadowed = n->binding;
+    n->binding = var;
+    var->frame_next = frames[frame_depth];
+    frames[frame_depth] = var;
+    return var;
+}
+
+static void assign_local(variable_t *var, const char *value) {
+    size_t len = strlen(value) + 1;
+    
+    if (len > var->cap) {
+        size_t cap = var->cap ? var->cap : 16;
+        char *grown;
         
-        prev = var;
-        var = var->next;
+        while (cap < len) {
+            cap *= 2;
+        }
+        grown = realloc(var->value, cap);
+        if (grown == NULL) {
+            perror("realloc");
+            return;
+        }
+        var->value = grown;
+        var->cap = cap;
     }
+    memcpy(var->value, value, len);
+    var->defined = 1;
 }
 
-void set_env_variable(char *name, char *value) {
-    lock_write_env();
+/*
+ * Valeur de name (len octets) : variable locale, sinon environnement partagé.
+ * Renvoie sa longueur, -1 si elle n'existe pas, et en copie au plus size - 1
+ * octets dans buf, terminés par '\0', comme snprintf : un premier appel avec
+ * size = 0 donne la taille à prévoir. Aucun état statique : peut être
+ * appelée de plusieurs threads.
+ */
+ssize_t lookup_variable(const char *name, size_t len, char *buf, size_t size) {
+    uint32_t hash = env_hash(name, len);
+    variable_t *var = find_local(intern_find(name, len, hash));
+    ssize_t found;
+    unsigned int seq;
     
-    int offset = 0;
-    int found_offset = -1;
-    int old_entry_len = 0;
+    if (var != NULL) {
+        size_t value_len = strlen(var->value);
+        if (size > 0) {
+            size_t n = value_len < size - 1 ? value_len : size - 1;
+            memcpy(buf, var->value, n);
+            buf[n] = '\0';
+        }
+        return value_len;
+    }
     
-    while (shared_env->data[offset] != '\0' || shared_env->data[offset + 1] != '\0') {
-        char *entry = shared_env->data + offset;
-        char *eq = strchr(entry, '=');
+    /* Copiée sous le seqlock : l'entrée peut changer dès la lecture finie */
+    do {
+        long slot;
         
-        if (eq != NULL) {
-            int name_len = eq - entry;
-            if (strncmp(entry, name, name_len) == 0 && name[name_len] == '\0') {
-                found_offset = offset;
-                old_entry_len = strlen(entry) + 1;
-                break;
+        seq = env_read_begin();
+        slot = env_find(name, len, hash, NULL);
+        found = -1;
+        if (slot >= 0) {
+            uint32_t offset = env_index()[slot];
+            env_entry_t *entry = env_entry(offset);
+            size_t value_len = entry->value_len;
+            
+            /* Entrée déplacée entre-temps : seq a changé, la lecture sera refaite */
+            if (offset > env_limit - sizeof(env_entry_t) ||
+                value_len > env_limit - offset - sizeof(env_entry_t) - len - 1) {
+                continue;
+            }
+            found = value_len;
+            if (size > 0) {
+                size_t n = value_len < size - 1 ? value_len : size - 1;
+                memcpy(buf, entry->text + len + 1, n);
+                buf[n] = '\0';
             }
         }
+    } while (env_read_retry(seq));
+    
+    return found;
+}
+
+/* Copie allouée de la valeur de name, NULL si elle n'existe pas */
+char *dup_variable(const char *name) {
+    size_t len = strlen(name);
+    
+    while (1) {
+        ssize_t need = lookup_variable(name, len, NULL, 0);
+        ssize_t got;
+        char *value;
         
-        offset += strlen(entry) + 1;
+        if (need < 0) {
+            return NULL;
+        }
+        value = malloc(need + 1);
+        if (value == NULL) {
+            perror("malloc");
+            return NULL;
+        }
+        got = lookup_variable(name, len, value, need + 1);
+        if (got >= 0 && got <= need) {
+            return value;
+        }
+        /* Supprimée ou allongée par un autre shell entre les deux lectures */
+        free(value);
+        if (got < 0) {
+            return NULL;
+        }
+    }
+}
+
+/* Affecte la liaison visible de name, créée dans le cadre courant s'il n'y en a pas */
+void set_local_variable(char *name, char *value) {
+    var_name_t *n;
+    variable_t *var;
+    
+    /* $PATH local masque celui de l'environnement */
+    if (strcmp(name, "PATH") == 0) {
+        clear_command_hash();
+    }
+    
+    n = intern_name(name);
+    if (n == NULL) {
+        return;
+    }
+    var = find_local(n);
+    if (var == NULL) {
+        /* Une liaison supprimée du cadre courant est reprise avec son tampon */
+        var = (n->binding != NULL && n->binding->frame == frame_depth) ? n->binding : bind_local(n);
+    }
+    if (var != NULL) {
+        assign_local(var, value);
+    }
+}
+
+/* Lie name dans le cadre courant, en masquant une liaison extérieure */
+void declare_local_variable(char *name, char *value) {
+    var_name_t *n;
+    variable_t *var;
+    
+    if (strcmp(name, "PATH") == 0) {
+        clear_command_hash();
+    }
+    
+    n = intern_name(name);
+    if (n == NULL) {
+        return;
+    }
+    var = (n->binding != NULL && n->binding->frame == frame_depth) ? n->binding : bind_local(n);
+    if (var != NULL) {
+        assign_local(var, value);
+    }
+}
+
+/* Supprime la liaison visible de name ; celle d'un cadre extérieur reparaît */
+void unset_local_variable(char *name) {
+    size_t len = strlen(name);
+    variable_t *var = find_local(intern_find(name, len, env_hash(name, len)));
+    
+    if (strcmp(name, "PATH") == 0) {
+        clear_command_hash();
+    }
+    
+    if (var != NULL) {
+        var->defined = 0;
+    }
+}
+
+/* Ouvre un cadre de variables, renvoie sa profondeur ou -1 */
+int push_variable_frame(void) {
+    if (frame_depth + 1 >= frame_cap) {
+        int cap = frame_cap ? frame_cap * 2 : 8;
+        variable_t **grown = realloc(frames, sizeof(variable_t *) * cap);
+        if (grown == NULL) {
+            perror("realloc");
+            return -1;
+        }
+        memset(grown + frame_cap, 0, sizeof(variable_t *) * (cap - frame_cap));
+        frames = grown;
+        frame_cap = cap;
     }
+    frame_depth++;
+    frames[frame_depth] = NULL;
+    return frame_depth;
+}
+
+/* Ferme le cadre courant : ses liaisons disparaissent, celles qu'elles masquaient reparaissent */
+void pop_variable_frame(void) {
+    variable_t *var;
     
-    char new_entry[MAX_VAR_NAME + MAX_VAR_VALUE + 2];
-    snprintf(new_entry, sizeof(new_entry), "%s=%s", name, value);
-    int new_entry_len = strlen(new_entry) + 1;
+    if (frame_depth == 0) {
+        return;
+    }
     
-    if (found_offset >= 0) {
-        int remaining = offset - found_offset - old_entry_len;
-        memmove(shared_env->data + found_offset + new_entry_len,
-                shared_env->data + found_offset + old_entry_len,
-                remaining + 2);
-        strcpy(shared_env->data + found_offset, new_entry);
-    } else {
-        strcpy(shared_env->data + offset, new_entry);
-        shared_env->data[offset + new_entry_len] = '\0';
+    var = frames[frame_depth];
+    while (var != NULL) {
+        variable_t *next = var->frame_next;
+        if (strcmp(var->name->text, "PATH") == 0) {
+            clear_command_hash();
+        }
+        var->name->binding = var->shadowed;
+        free(var->value);
+        free(var);
+        var = next;
     }
+    frames[frame_depth--] = NULL;
+}
+
+void set_env_variable(char *name, char *value) {
+    int ret;
     
+    if (strcmp(name, "PATH") == 0) {
+        clear_command_hash();
+    }
+    
+    lock_write_env();
+    ret = env_store_growing(name, strlen(name), value);
     unlock_write_env();
+    
+    if (ret == ENV_TOO_BIG) {
+        fprintf(stderr, "setenv: %s: valeur trop grande (%u Mo au plus)\n",
+                name, (ENV_MAX_SIZE / 2) >> 20);
+    } else if (ret < 0) {
+        fprintf(stderr, "setenv: environnement partagé plein\n");
+    }
 }
 
 void unset_env_variable(char *name) {
+    if (strcmp(name, "PATH") == 0) {
+        clear_command_hash();
+    }
+    
     lock_write_env();
+    env_remove(name);
+    unlock_write_env();
+}
+
+/* Longueur du nom de variable qui commence en p */
+static size_t name_length(const char *p) {
+    size_t n = 0;
     
-    int offset = 0;
+    while (isalnum((unsigned char)p[n]) || p[n] == '_') {
+        n++;
+    }
+    return n;
+}
+
+/* Garantit need octets libres (plus le '\0') dans le résultat, pris dans line_arena */
+static char *reserve_expansion(char *buf, size_t *cap, size_t used, size_t need) {
+    size_t new_cap = *cap;
     
-    while (shared_env->data[offset] != '\0' || shared_env->data[offset + 1] != '\0') {
-        char *entry = shared_env->data + offset;
-        char *eq = strchr(entry, '=');
-        
-        if (eq != NULL) {
-            int name_len = eq - entry;
-            if (strncmp(entry, name, name_len) == 0 && name[name_len] == '\0') {
-                int entry_len = strlen(entry) + 1;
-                int remaining_offset = offset + entry_len;
-                
-                int total_offset = remaining_offset;
-                while (shared_env->data[total_offset] != '\0' || 
-                       shared_env->data[total_offset + 1] != '\0') {
-                    total_offset += strlen(shared_env->data + total_offset) + 1;
+    if (used + need < *cap) {
+        return buf;
+    }
+    while (used + need >= new_cap) {
+        new_cap *= 2;
+    }
+    buf = arena_grow(&line_arena, buf, *cap, new_cap);
+    *cap = new_cap;
+    return buf;
+}
+
+/*
+ * Remplace les $NOM de str ; \$ donne un '$'. Sans '$', str est renvoyée
+ * telle quelle. Sinon une première passe mesure le résultat, écrit ensuite
+ * dans line_arena sans copie intermédiaire. Une valeur allongée par un autre
+ * shell entre les deux passes fait grandir le tampon. Renvoie NULL si la
+ * mémoire manque.
+ */
+char *expand_variables(char *str) {
+    size_t size = 0;
+    size_t cap;
+    size_t j = 0;
+    char *result;
+    char *p;
+    
+    if (strchr(str, '$') == NULL) {
+        return str;
+    }
+    
+    for (p = str; *p != '\0'; ) {
+        if (*p == '$') {
+            size_t len = name_length(p + 1);
+            ssize_t n = lookup_variable(p + 1, len, NULL, 0);
+            size += (n > 0) ? n : 0;
+            p += len + 1;
+        } else if (*p == '\\' && p[1] == '$') {
+            size++;
+            p += 2;
+        } else {
+            size++;
+            p++;
+        }
+    }
+    
+    cap = size + 1;
+    result = arena_alloc(&line_arena, cap);
+    if (result == NULL) {
+        return NULL;
+    }
+    
+    for (p = str; *p != '\0'; ) {
+        if (*p == '$') {
+            size_t len = name_length(p + 1);
+            ssize_t n;
+            
+            while ((n = lookup_variable(p + 1, len, result + j, cap - j)) >= 0 &&
+                   (size_t)n >= cap - j) {
+                result = reserve_expansion(result, &cap, j, n);
+                if (result == NULL) {
+                    return NULL;
                 }
-                
-                memmove(shared_env->data + offset,
-                        shared_env->data + remaining_offset,
-                        total_offset - remaining_offset + 2);
-                
-                unlock_write_env();
-                return;
             }
+            j += (n > 0) ? n : 0;
+            p += len + 1;
+        } else {
+            /* Morceau sans '$' ni '\' recopié d'un bloc */
+            size_t run = (*p == '\\') ? 1 : strcspn(p, "$\\");
+            const char *from = p;
+            
+            if (*p == '\\' && p[1] == '$') {
+                from = p + 1;
+                p++;
+            }
+            result = reserve_expansion(result, &cap, j, run);
+            if (result == NULL) {
+                return NULL;
+            }
+            memcpy(result + j, from, run);
+            j += run;
+            p += run;
         }
-        
-        offset += strlen(entry) + 1;
     }
     
-    unlock_write_env();
+    result[j] = '\0';
+    return result;
 }
 
-char *expand_variables(char *str) {
-    static char result[MAX_LINE];
-    char var_name[MAX_VAR_NAME];
-    int i = 0, j = 0;
-    
-    while (str[i] != '\0') {
-        if (str[i] == '$' && (i == 0 || str[i-1] != '\\')) {
-            i++;
-            int k = 0;
+/* Mot en cours de construction par expand_word(), dans line_arena */
+typedef struct {
+    char *buf;
+    size_t len;
+    size_t cap;
+    int started;            /* un mot existe, même vide ("") */
+} field_t;
+
+/* Caractères que les motifs et leurs ensembles [...] interprètent :
+ * protégés par '\' s'ils étaient cités */
+#define PATTERN_SPECIAL "*?[]-!^\\~"
+
+static int field_put(field_t *f, char c) {
+    if (f->len + 2 >= f->cap) {
+        char *buf = arena_grow(&line_arena, f->buf, f->cap, f->cap * 2);
+        if (buf == NULL) {
+            return -1;
+        }
+        f->buf = buf;
+        f->cap *= 2;
+    }
+    f->buf[f->len++] = c;
+    f->started = 1;
+    return 0;
+}
+
+/* Ajoute c, cité : un caractère de motif devient littéral */
+static int field_put_quoted(field_t *f, char c) {
+    if (c != '\0' && strchr(PATTERN_SPECIAL, c) != NULL && field_put(f, '\\') < 0) {
+        return -1;
+    }
+    return field_put(f, c);
+}
+
+/* Termine le mot en cours et l'ajoute à out */
+static int field_end(field_t *f, command_t *out) {
+    if (!f->started) {
+        return 0;
+    }
+    f->buf[f->len] = '\0';
+    if (add_argument(out, f->buf) < 0) {
+        return -1;
+    }
+    f->cap = 32;
+    f->len = 0;
+    f->started = 0;
+    f->buf = arena_alloc(&line_arena, f->cap);
+    return f->buf != NULL ? 0 : -1;
+}
+
+/* Valeur de la variable nommée par les len octets de name, "" si elle n'existe pas */
+static const char *variable_value(const char *name, size_t len) {
+    size_t cap = 64;
+    char *buf = arena_alloc(&line_arena, cap);
+    ssize_t n;
+    
+    if (buf == NULL) {
+        return NULL;
+    }
+    while ((n = lookup_variable(name, len, buf, cap)) >= 0 && (size_t)n >= cap) {
+        buf = reserve_expansion(buf, &cap, 0, n);
+        if (buf == NULL) {
+            return NULL;
+        }
+    }
+    if (n < 0) {
+        buf[0] = '\0';
+    }
+    return buf;
+}
+
+/*
+ * Ajoute à out les mots que donne word, tel qu'écrit sur la ligne : les
+ * guillemets et les '\' sont retirés, les $NOM remplacés (pas entre
+ * apostrophes). Si split, une valeur hors guillemets est coupée aux blancs
+ * et une valeur vide ne donne aucun mot. Les caractères de motif cités
+ * restent protégés par un '\' pour expand_wildcards(), qui les retire.
+ * Renvoie -1 si la mémoire manque.
+ */
+int expand_word(const char *word, command_t *out, int split) {
+    field_t f = { NULL, 0, 32, 0 };
+    const char *p = word;
+    
+    /* Mot ordinaire : rien à développer ni à protéger */
+    if (strpbrk(word, "'\"\\$") == NULL) {
+        return add_argument(out, (char *)word);
+    }
+    
+    f.buf = arena_alloc(&line_arena, f.cap);
+    if (f.buf == NULL) {
+        return -1;
+    }
+    
+    while (*p != '\0') {
+        if (*p == '\\') {
+            if (p[1] != '\0' && field_put_quoted(&f, p[1]) < 0) {
+                return -1;
+            }
+            f.started = 1;
+            p += (p[1] != '\0') ? 2 : 1;
+        } else if (*p == '\'') {
+            const char *end = strchrnul(p + 1, '\'');
             
-            while (str[i] && (isalnum(str[i]) || str[i] == '_')) {
-                var_name[k++] = str[i++];
+            f.started = 1;
+            for (p++; p < end; p++) {
+                if (field_put_quoted(&f, *p) < 0) {
+                    return -1;
+                }
+            }
+            if (*p == '\'') {
+                p++;
             }
-            var_name[k] = '\0';
+        } else if (*p == '"') {
+            f.started = 1;
+            for (p++; *p != '"' && *p != '\0'; ) {
+                size_t len = (*p == '$') ? name_length(p + 1) : 0;
+                
+                if (len > 0) {
+                    const char *value = variable_value(p + 1, len);
+                    if (value == NULL) {
+                        return -1;
+                    }
+                    for (; *value != '\0'; value++) {
+                        if (field_put_quoted(&f, *value) < 0) {
+                            return -1;
+                        }
+                    }
+                    p += len + 1;
+                    continue;
+                }
+                if (*p == '\\' && (p[1] == '"' || p[1] == '\\' || p[1] == '$')) {
+                    p++;
+                }
+                if (field_put_quoted(&f, *p++) < 0) {
+                    return -1;
+                }
+            }
+            if (*p == '"') {
+                p++;
+            }
+        } else if (*p == '$' && name_length(p + 1) > 0) {
+            size_t len = name_length(p + 1);
+            const char *value = variable_value(p + 1, len);
             
-            char *value = get_variable(var_name);
-            if (value != NULL) {
-                strcpy(result + j, value);
-                j += strlen(value);
+            if (value == NULL) {
+                return -1;
             }
-        } else if (str[i] == '\\' && str[i+1] == '$') {
-            result[j++] = '$';
-            i += 2;
+            for (; *value != '\0'; value++) {
+                int err;
+                
+                if (split && (*value == ' ' || *value == '\t' || *value == '\n')) {
+                    err = field_end(&f, out);
+                } else if (*value == '\\') {
+                    err = field_put_quoted(&f, *value);
+                } else {
+                    err = field_put(&f, *value);
+                }
+                if (err < 0) {
+                    return -1;
+                }
+            }
+            p += len + 1;
         } else {
-            result[j++] = str[i++];
+            if (field_put(&f, *p++) < 0) {
+                return -1;
+            }
         }
     }
     
-    result[j] = '\0';
-    return strdup(result);
+    /* Sans découpage, même une valeur vide donne un mot */
+    if (!split) {
+        f.started = 1;
+    }
+    return field_end(&f, out);
 }
 
+static int compare_entries(const void *a, const void *b) {
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+static int compare_locals(const void *a, const void *b) {
+    return strcmp((*(variable_t * const *)a)->name->text, (*(variable_t * const *)b)->name->text);
+}
+
+/* Affiche les variables locales visibles, triées par nom */
 void print_local_variables(void) {
-    variable_t *var = local_vars;
+    variable_t **visible;
+    uint32_t n = 0;
     
-    while (var != NULL) {
-        printf("%s=%s\n", var->name, var->value);
-        var = var->next;
+    if (name_count == 0) {
+        return;
     }
+    visible = malloc(sizeof(variable_t *) * name_count);
+    if (visible == NULL) {
+        perror("malloc");
+        return;
+    }
+    for (uint32_t i = 0; i < name_bucket_count; i++) {
+        for (var_name_t *name = name_buckets[i]; name != NULL; name = name->next) {
+            variable_t *var = find_local(name);
+            if (var != NULL) {
+                visible[n++] = var;
+            }
+        }
+    }
+    
+    qsort(visible, n, sizeof(variable_t *), compare_locals);
+    for (uint32_t i = 0; i < n; i++) {
+        printf("%s=%s\n", visible[i]->name->text, visible[i]->value);
+    }
+    free(visible);
+}
+
+/*
+ * envp des commandes lancées, tiré du segment et gardé tant que seq n'a pas
+ * bougé : toute écriture le change, un exec sans setenv entre-temps ne coûte
+ * qu'une lecture de seq. env_array_text est une copie du tas, les chaînes
+ * "NOM=valeur" de env_array pointent dedans.
+ */
+static char **env_array = NULL;
+static char *env_array_text = NULL;
+static unsigned int env_array_seq = 1;  /* impair : jamais construit */
+
+static int env_build_array(void) {
+    char *copy = NULL;
+    char **lines = NULL;
+    uint32_t n = 0;
+    unsigned int seq;
+    
+    do {
+        uint32_t slots;
+        uint32_t used;
+        
+        seq = env_read_begin();
+        slots = shared_env->index_slots;
+        used = shared_env->heap_used;
+        free(copy);
+        free(lines);
+        if (used > env_limit) {
+            used = env_limit;
+        }
+        copy = malloc(used);
+        lines = malloc(sizeof(char *) * (slots + 1));
+        if (copy == NULL || lines == NULL) {
+            free(copy);
+            free(lines);
+            perror("malloc");
+            return -1;
+        }
+        memcpy(copy, shared_env->data, used);
+        n = 0;
+        for (uint32_t i = 0; i < slots && i * sizeof(uint32_t) < used; i++) {
+            uint32_t offset = ((uint32_t *)copy)[i];
+            if (offset != 0 && offset != ENV_TOMBSTONE && offset < used - sizeof(env_entry_t)) {
+                lines[n++] = ((env_entry_t *)(copy + offset))->text;
+            }
+        }
+    } while (env_read_retry(seq));
+    lines[n] = NULL;
+    
+    free(env_array);
+    free(env_array_text);
+    env_array = lines;
+    env_array_text = copy;
+    env_array_seq = seq;
+    shell_stats.env_builds++;
+    return 0;
 }
 
+/*
+ * Environnement à passer à execve / posix_spawn, reconstruit seulement si une
+ * écriture a eu lieu depuis. Reste valable jusqu'au prochain appel.
+ */
+char **get_env_array(void) {
+    if (shared_env == NULL) {
+        return environ;
+    }
+    if (atomic_load_explicit(&shared_env->seq, memory_order_acquire) != env_array_seq &&
+        env_build_array() < 0 && env_array == NULL) {
+        return environ;
+    }
+    return env_array;
+}
+
+/* Affiche l'environnement trié par nom */
 void print_env_variables(void) {
-    lock_read_env();
+    char **env = get_env_array();
+    size_t n = 0;
     
-    int offset = 0;
-    while (shared_env->data[offset] != '\0' || shared_env->data[offset + 1] != '\0') {
-        printf("%s\n", shared_env->data + offset);
-        offset += strlen(shared_env->data + offset) + 1;
+    while (env[n] != NULL) {
+        n++;
+    }
+    /* L'ordre de envp est indifférent : le tri se fait sur place */
+    qsort(env, n, sizeof(char *), compare_entries);
+    for (size_t i = 0; i < n; i++) {
+        printf("%s\n", env[i]);
+    }
+}
+
+static volatile sig_atomic_t waitenv_interrupted = 0;
+
+static void waitenv_sigint(int sig) {
+    (void)sig;
+    waitenv_interrupted = 1;
+}
+
+/* Vrai si les deux valeurs (NULL : variable absente) diffèrent */
+static int value_changed(const char *old, const char *cur) {
+    if (old == NULL || cur == NULL) {
+        return old != cur;
+    }
+    return strcmp(old, cur) != 0;
+}
+
+/*
+ * mywaitenv VAR [secondes] : attend que VAR soit définie, modifiée ou
+ * supprimée par n'importe quel shell. Renvoie 0 au changement, 1 à
+ * l'expiration du délai, 130 sur Ctrl-C.
+ */
+int builtin_waitenv(char **argv) {
+    struct sigaction sa, old_sa;
+    struct timespec deadline, now, left;
+    sigset_t intmask, old_mask;
+    double seconds = -1;
+    char *initial;
+    char *value;
+    int changed;
+    int ret = -1;
+    
+    if (argv[1] == NULL || (argv[2] != NULL && argv[3] != NULL)) {
+        fprintf(stderr, "mywaitenv: usage: mywaitenv VAR [secondes]\n");
+        return 2;
+    }
+    if (argv[2] != NULL) {
+        char *end;
+        seconds = strtod(argv[2], &end);
+        if (*argv[2] == '\0' || *end != '\0' || seconds < 0) {
+            fprintf(stderr, "mywaitenv: délai invalide: %s\n", argv[2]);
+            return 2;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += (time_t)seconds;
+        deadline.tv_nsec += (long)((seconds - (time_t)seconds) * 1e9);
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+    }
+    
+    initial = dup_variable(argv[1]);
+    
+    /* SIGINT, lu d'ordinaire par signalfd, doit pouvoir couper l'attente */
+    waitenv_interrupted = 0;
+    sa.sa_handler = waitenv_sigint;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = 0;
+    sigaction(SIGINT, &sa, &old_sa);
+    sigemptyset(&intmask);
+    sigaddset(&intmask, SIGINT);
+    sigprocmask(SIG_UNBLOCK, &intmask, &old_mask);
+    
+    while (ret < 0) {
+        /* changes est lu avant la valeur : une écriture entre les deux réveille */
+        unsigned int seen = env_changes();
+        
+        value = dup_variable(argv[1]);
+        changed = value_changed(initial, value);
+        free(value);
+        if (changed) {
+            ret = 0;
+            break;
+        }
+        if (waitenv_interrupted) {
+            ret = 130;
+            break;
+        }
+        if (seconds >= 0) {
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            left.tv_sec = deadline.tv_sec - now.tv_sec;
+            left.tv_nsec = deadline.tv_nsec - now.tv_nsec;
+            if (left.tv_nsec < 0) {
+                left.tv_sec--;
+                left.tv_nsec += 1000000000L;
+            }
+            if (left.tv_sec < 0) {
+                ret = 1;
+                break;
+            }
+        }
+        if (env_wait_change(seen, seconds >= 0 ? &left : NULL) < 0 && errno == ETIMEDOUT) {
+            ret = 1;
+        }
     }
     
-    unlock_read_env();
+    sigprocmask(SIG_SETMASK, &old_mask, NULL);
+    sigaction(SIGINT, &old_sa, NULL);
+    free(initial);
+    return ret;
 }
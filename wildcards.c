@@ -1,132 +1,1222 @@
 #include "mysh.h"
 
-static int match_pattern(const char *pattern, const char *str);
-static int match_bracket(const char *pattern, char c, int *skip);
+/*
+ * Expansion des motifs * ? [...] [^...] des arguments.
+ * Le moteur interne (myopt glob=builtin) compile chaque composant du motif
+ * en une suite d'atomes, filtre les noms par leur préfixe et leur suffixe
+ * littéraux puis les compare sans récursion ; les répertoires sont lus
+ * à travers dircache. Les motifs d'une même commande qui portent sur le même
+ * répertoire sont réunis en un seul automate et comparés en une passe.
+ * glob(3) reste disponible avec myopt glob=libc.
+ */
 
-char **expand_wildcards(char **argv, int *argc) {
-    glob_t globbuf;
-    char **new_argv;
-    int new_argc = 0;
-    int i, j;
+/* Atomes d'un composant de motif compilé */
+#define ATOM_CHAR  0
+#define ATOM_ANY   1
+#define ATOM_CLASS 2
+#define ATOM_STAR  3
+
+typedef struct {
+    unsigned char type;
+    unsigned char c;            /* ATOM_CHAR */
+    unsigned short cls;         /* ATOM_CLASS : indice dans classes */
+} atom_t;
+
+/* Un composant du motif (entre deux '/') */
+typedef struct {
+    atom_t *atoms;
+    int natoms;
+    int match_atoms;            /* atomes restant à comparer hors suffixe littéral */
+    unsigned char (*classes)[32];
+    int nclasses;
+    int has_wild;
+    int has_star;
+    int globstar;               /* composant ** : zéro ou plusieurs répertoires */
+    char *text;                 /* composant sans échappements si !has_wild */
+    char *prefix;               /* caractères littéraux de tête */
+    int prefix_len;
+    char *suffix;               /* caractères littéraux après la dernière '*' */
+    int suffix_len;
+    const char *sep;            /* '/' qui suivent le composant, tels qu'écrits */
+    int sep_len;
+} pattern_t;
+
+/* État d'une expansion : chemin en cours de construction et résultats */
+typedef struct {
+    pattern_t *comps;
+    int ncomps;
+    int trailing_slash;
+    char *path;
+    size_t len;
+    size_t cap;
+    command_t *out;
+    int found;
+    int err;
+} expand_t;
+
+static const struct {
+    const char *name;
+    int (*test)(int);
+} named_classes[] = {
+    { "alnum", isalnum }, { "alpha", isalpha }, { "blank", isblank },
+    { "cntrl", iscntrl }, { "digit", isdigit }, { "graph", isgraph },
+    { "lower", islower }, { "print", isprint }, { "punct", ispunct },
+    { "space", isspace }, { "upper", isupper }, { "xdigit", isxdigit },
+};
+
+static void set_bit(unsigned char *set, unsigned char c) {
+    set[c >> 3] |= 1 << (c & 7);
+}
+
+static int test_bit(const unsigned char *set, unsigned char c) {
+    return set[c >> 3] & (1 << (c & 7));
+}
+
+/*
+ * Compile l'ensemble [...] qui commence en p dans set. Renvoie le nombre de
+ * caractères lus, 0 s'il n'est pas refermé (le '[' est alors littéral).
+ */
+static int compile_class(const char *p, unsigned char *set) {
+    int i = 1;
+    int negate = 0;
+    int first = 1;
+    
+    memset(set, 0, 32);
     
-    new_argv = malloc(sizeof(char *) * MAX_ARGS);
-    if (new_argv == NULL) {
-        return argv;
+    if (p[i] == '!' || p[i] == '^') {
+        negate = 1;
+        i++;
     }
     
-    for (i = 0; i < *argc; i++) {
-        if (strchr(argv[i], '*') != NULL || 
-            strchr(argv[i], '?') != NULL || 
-            strchr(argv[i], '[') != NULL) {
+    while (p[i] != '\0' && (p[i] != ']' || first)) {
+        unsigned char lo;
+        unsigned char hi;
+        
+        first = 0;
+        
+        if (p[i] == '[' && p[i + 1] == ':') {
+            const char *end = strstr(p + i + 2, ":]");
+            size_t len = (end != NULL) ? (size_t)(end - (p + i + 2)) : 0;
+            size_t k;
             
-            int has_unescaped = 0;
-            for (j = 0; argv[i][j]; j++) {
-                if ((argv[i][j] == '*' || argv[i][j] == '?' || argv[i][j] == '[') &&
-                    (j == 0 || argv[i][j-1] != '\\')) {
-                    has_unescaped = 1;
+            for (k = 0; end != NULL && k < sizeof(named_classes) / sizeof(named_classes[0]); k++) {
+                if (strlen(named_classes[k].name) == len &&
+                    strncmp(named_classes[k].name, p + i + 2, len) == 0) {
                     break;
                 }
             }
-            
-            if (!has_unescaped) {
-                new_argv[new_argc++] = strdup(argv[i]);
+            if (end != NULL && k < sizeof(named_classes) / sizeof(named_classes[0])) {
+                for (int c = 1; c < 256; c++) {
+                    if (named_classes[k].test(c)) {
+                        set_bit(set, c);
+                    }
+                }
+                i = end + 2 - p;
                 continue;
             }
-            
-            int flags = GLOB_NOCHECK | GLOB_TILDE;
-            if (glob(argv[i], flags, NULL, &globbuf) == 0) {
-                for (j = 0; j < (int)globbuf.gl_pathc; j++) {
-                    new_argv[new_argc++] = strdup(globbuf.gl_pathv[j]);
-                }
-                globfree(&globbuf);
-            } else {
-                new_argv[new_argc++] = strdup(argv[i]);
+        }
+        
+        if (p[i] == '\\' && p[i + 1] != '\0') {
+            i++;
+        }
+        lo = p[i++];
+        
+        if (p[i] == '-' && p[i + 1] != '\0' && p[i + 1] != ']') {
+            i++;
+            if (p[i] == '\\' && p[i + 1] != '\0') {
+                i++;
+            }
+            hi = p[i++];
+            for (int c = lo; c <= hi; c++) {
+                set_bit(set, c);
             }
         } else {
-            new_argv[new_argc++] = strdup(argv[i]);
+            set_bit(set, lo);
         }
     }
     
-    new_argv[new_argc] = NULL;
+    if (p[i] != ']') {
+        return 0;
+    }
     
-    for (i = 0; i < *argc; i++) {
-        free(argv[i]);
+    if (negate) {
+        for (int k = 0; k < 32; k++) {
+            set[k] = ~set[k];
+        }
     }
-    free(argv);
+    set[0] &= ~1;
     
-    *argc = new_argc;
-    return new_argv;
+    return i + 1;
 }
 
-static int match_bracket(const char *pattern, char c, int *skip) {
-    int negate = 0;
-    int match = 0;
-    int i = 0;
+/*
+ * Compile le composant src (len octets) dans line_arena. Un '\\' rend le
+ * caractère suivant littéral : expand_word() en met devant les caractères
+ * cités ("*", '[a-z]', \?), compile_class() fait de même dans un ensemble.
+ */
+static int compile_pattern(pattern_t *p, const char *src, size_t len) {
+    char *s = arena_alloc(&line_arena, len + 1);
+    int first_star = -1;
+    int last_star = -1;
+    size_t i = 0;
     
-    if (pattern[0] == '^') {
-        negate = 1;
-        i++;
+    memset(p, 0, sizeof(pattern_t));
+    p->atoms = arena_alloc(&line_arena, sizeof(atom_t) * (len + 1));
+    p->classes = arena_alloc(&line_arena, 32 * (len / 3 + 1));
+    p->text = arena_alloc(&line_arena, len + 1);
+    if (s == NULL || p->atoms == NULL || p->classes == NULL || p->text == NULL) {
+        return -1;
     }
+    memcpy(s, src, len);
+    s[len] = '\0';
     
-    while (pattern[i] && pattern[i] != ']') {
-        if (pattern[i+1] == '-' && pattern[i+2] && pattern[i+2] != ']') {
-            if (c >= pattern[i] && c <= pattern[i+2]) {
-                match = 1;
+    while (i < len) {
+        atom_t *atom = &p->atoms[p->natoms];
+        
+        if (s[i] == '\\' && i + 1 < len) {
+            atom->type = ATOM_CHAR;
+            atom->c = s[i + 1];
+            i += 2;
+        } else if (s[i] == '*') {
+            i++;
+            p->has_wild = p->has_star = 1;
+            if (p->natoms > 0 && p->atoms[p->natoms - 1].type == ATOM_STAR) {
+                continue;
+            }
+            atom->type = ATOM_STAR;
+            if (first_star < 0) {
+                first_star = p->natoms;
+            }
+            last_star = p->natoms;
+        } else if (s[i] == '?') {
+            atom->type = ATOM_ANY;
+            p->has_wild = 1;
+            i++;
+        } else if (s[i] == '[') {
+            int n = compile_class(s + i, p->classes[p->nclasses]);
+            if (n > 0) {
+                atom->type = ATOM_CLASS;
+                atom->cls = p->nclasses++;
+                p->has_wild = 1;
+                i += n;
+            } else {
+                atom->type = ATOM_CHAR;
+                atom->c = '[';
+                i++;
             }
-            i += 3;
         } else {
-            if (c == pattern[i]) {
-                match = 1;
+            atom->type = ATOM_CHAR;
+            atom->c = s[i++];
+        }
+        p->natoms++;
+    }
+    
+    /* Préfixe et suffixe littéraux pour écarter vite les noms */
+    p->prefix = p->text;
+    while (p->prefix_len < p->natoms && p->atoms[p->prefix_len].type == ATOM_CHAR) {
+        p->text[p->prefix_len] = p->atoms[p->prefix_len].c;
+        p->prefix_len++;
+    }
+    p->text[p->prefix_len] = '\0';
+    
+    if (p->has_star) {
+        int k;
+        p->suffix = arena_alloc(&line_arena, p->natoms - last_star);
+        if (p->suffix == NULL) {
+            return -1;
+        }
+        for (k = last_star + 1; k < p->natoms && p->atoms[k].type == ATOM_CHAR; k++) {
+            p->suffix[p->suffix_len++] = p->atoms[k].c;
+        }
+        if (k < p->natoms) {
+            p->suffix_len = 0;
+        }
+    }
+    p->match_atoms = (p->suffix_len > 0) ? last_star + 1 : p->natoms;
+    (void)first_star;
+    
+    return 0;
+}
+
+static int atom_matches(const pattern_t *p, const atom_t *atom, unsigned char c) {
+    switch (atom->type) {
+        case ATOM_CHAR:
+            return atom->c == c;
+        case ATOM_ANY:
+            return 1;
+        case ATOM_CLASS:
+            return test_bit(p->classes[atom->cls], c);
+        default:
+            return 0;
+    }
+}
+
+/*
+ * Première position >= from où l'atome k peut commencer : memchr saute
+ * directement au prochain caractère littéral attendu après une '*'.
+ * Renvoie (size_t)-1 s'il n'y en a plus.
+ */
+static size_t next_candidate(const pattern_t *p, int k, const char *name, size_t from, size_t end) {
+    const char *next;
+    
+    if (p->atoms[k].type != ATOM_CHAR) {
+        return from;
+    }
+    next = (from < end) ? memchr(name + from, p->atoms[k].c, end - from) : NULL;
+    return (next != NULL) ? (size_t)(next - name) : (size_t)-1;
+}
+
+/*
+ * Compare name (len octets) au composant p. Le préfixe et le suffixe
+ * littéraux sont vérifiés d'abord par memcmp, seul le milieu passe par les
+ * atomes. Sans récursion : la dernière '*' rencontrée sert de seul point de
+ * reprise, le coût reste borné par longueur du milieu × nombre d'atomes,
+ * jamais exponentiel ; une '*' finale accepte aussitôt le reste du nom.
+ */
+/* Tests en temps constant : '.' de tête, préfixe, suffixe et longueur */
+static int pattern_prefilter(const pattern_t *p, const char *name, size_t len) {
+    /* Un '.' en tête ne correspond qu'à un '.' explicite */
+    if (name[0] == '.' && !(p->prefix_len > 0 && p->prefix[0] == '.')) {
+        return 0;
+    }
+    
+    if (len < (size_t)(p->prefix_len + p->suffix_len) ||
+        memcmp(name, p->prefix, p->prefix_len) != 0 ||
+        memcmp(name + len - p->suffix_len, p->suffix, p->suffix_len) != 0) {
+        return 0;
+    }
+    return p->has_star || len == (size_t)p->natoms;
+}
+
+static int pattern_match(const pattern_t *p, const char *name, size_t len) {
+    size_t end = len - p->suffix_len;
+    int n = p->match_atoms;
+    int i = p->prefix_len;
+    size_t j = p->prefix_len;
+    int star_i = -1;
+    size_t star_j = 0;
+    
+    if (!pattern_prefilter(p, name, len)) {
+        return 0;
+    }
+    
+    while (j < end) {
+        if (i < n && p->atoms[i].type == ATOM_STAR) {
+            if (i == n - 1) {
+                return 1;
+            }
+            star_i = ++i;
+            star_j = j = next_candidate(p, i, name, j, end);
+            if (j == (size_t)-1) {
+                return 0;
             }
+        } else if (i < n && atom_matches(p, &p->atoms[i], name[j])) {
             i++;
+            j++;
+        } else if (star_i >= 0) {
+            i = star_i;
+            star_j = j = next_candidate(p, i, name, star_j + 1, end);
+            if (j == (size_t)-1) {
+                return 0;
+            }
+        } else {
+            return 0;
+        }
+    }
+    
+    while (i < n && p->atoms[i].type == ATOM_STAR) {
+        i++;
+    }
+    return i == n;
+}
+
+/* Ajoute n octets au chemin courant, renvoie l'ancienne longueur */
+static size_t path_push(expand_t *ex, const char *s, size_t n) {
+    size_t mark = ex->len;
+    
+    if (ex->len + n + 1 > ex->cap) {
+        size_t cap = ex->cap ? ex->cap : 256;
+        char *grown;
+        while (ex->len + n + 1 > cap) {
+            cap *= 2;
+        }
+        grown = realloc(ex->path, cap);
+        if (grown == NULL) {
+            ex->err = -1;
+            return mark;
         }
+        ex->path = grown;
+        ex->cap = cap;
+    }
+    
+    memcpy(ex->path + ex->len, s, n);
+    ex->len += n;
+    ex->path[ex->len] = '\0';
+    return mark;
+}
+
+static void path_pop(expand_t *ex, size_t mark) {
+    ex->len = mark;
+    if (ex->path != NULL) {
+        ex->path[mark] = '\0';
     }
+}
+
+static void add_path(expand_t *ex) {
+    char *copy = arena_strdup(&line_arena, ex->path);
     
-    *skip = i + 1;  
+    if (copy == NULL || add_argument(ex->out, copy) < 0) {
+        ex->err = -1;
+        return;
+    }
+    ex->found++;
+}
+
+static void emit_path(expand_t *ex) {
+    size_t mark = ex->len;
     
-    return negate ? !match : match;
+    if (ex->trailing_slash) {
+        pattern_t *p = &ex->comps[ex->ncomps - 1];
+        path_push(ex, p->sep, p->sep_len);
+    }
+    add_path(ex);
+    path_pop(ex, mark);
 }
 
-static int match_pattern(const char *pattern, const char *str) {
-    if (*pattern == '\0' && *str == '\0') {
+/* Le chemin courant est-il un répertoire ? d_type évite le stat quand il est connu */
+static int is_directory(expand_t *ex, unsigned char type) {
+    struct stat st;
+    
+    if (type == DT_DIR) {
         return 1;
     }
+    if (type != DT_UNKNOWN && type != DT_LNK) {
+        return 0;
+    }
+    return stat(ex->path, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+static void walk(expand_t *ex, int level);
+
+static int match_component(const void *pattern, const char *name, size_t len) {
+    return pattern_match(pattern, name, len);
+}
+
+/*
+ * Composant ** : l'arborescence sous le chemin courant est parcourue en
+ * parallèle par tree_walk. Si ** est le dernier composant, ou s'il n'est
+ * suivi que d'un seul, les threads comparent eux-mêmes les entrées ; sinon
+ * ils rendent la liste des répertoires et la suite du motif est appliquée
+ * à chacun.
+ */
+static void walk_globstar(expand_t *ex, int level) {
+    int last = (level == ex->ncomps - 1);
+    pattern_t match_all;
+    tree_walk_t tw;
+    
+    /* ** suivi de ** : un seul suffit, sinon chaque chemin sortirait plusieurs fois */
+    if (!last && ex->comps[level + 1].globstar) {
+        walk(ex, level + 1);
+        return;
+    }
+    
+    /* Comme bash, « a/ ** » donne aussi le répertoire a/ lui-même */
+    if (last && ex->len > 0 && is_directory(ex, DT_UNKNOWN)) {
+        add_path(ex);
+    }
+    
+    memset(&tw, 0, sizeof(tw));
+    tw.root = ex->path;
+    tw.dirs_only = ex->trailing_slash;
+    
+    if (last) {
+        if (compile_pattern(&match_all, "*", 1) < 0) {
+            ex->err = -1;
+            return;
+        }
+        tw.match = match_component;
+        tw.pattern = &match_all;
+    } else if (level + 1 == ex->ncomps - 1 && !ex->comps[level + 1].globstar) {
+        tw.match = match_component;
+        tw.pattern = &ex->comps[level + 1];
+    }
+    
+    if (tree_walk(&tw) < 0) {
+        ex->err = -1;
+        return;
+    }
+    shell_stats.globstar_walks++;
+    shell_stats.globstar_dirs += tw.dirs;
     
-    if (*pattern == '\\' && *(pattern + 1)) {
-        if (*(pattern + 1) == *str) {
-            return match_pattern(pattern + 2, str + 1);
+    for (size_t i = 0; i < tw.count && !ex->err; i++) {
+        size_t mark = path_push(ex, tw.results[i], strlen(tw.results[i]));
+        
+        if (tw.match != NULL) {
+            emit_path(ex);
+        } else {
+            walk(ex, level + 1);
         }
+        path_pop(ex, mark);
+    }
+    
+    tree_walk_free(&tw);
+}
+
+static void walk(expand_t *ex, int level) {
+    pattern_t *p = &ex->comps[level];
+    int last = (level == ex->ncomps - 1);
+    dir_listing_t *listing;
+    
+    if (ex->err) {
+        return;
+    }
+    
+    if (p->globstar) {
+        walk_globstar(ex, level);
+        return;
+    }
+    
+    /* Composant littéral : pas de lecture du répertoire */
+    if (!p->has_wild) {
+        size_t mark = path_push(ex, p->text, p->prefix_len);
+        struct stat st;
+        
+        if (!last) {
+            path_push(ex, p->sep, p->sep_len);
+            walk(ex, level + 1);
+        } else if (lstat(ex->path, &st) == 0 &&
+                   (!ex->trailing_slash || is_directory(ex, DT_UNKNOWN))) {
+            emit_path(ex);
+        }
+        path_pop(ex, mark);
+        return;
+    }
+    
+    listing = dircache_get(ex->len > 0 ? ex->path : "");
+    if (listing == NULL) {
+        return;
+    }
+    
+    for (int i = 0; i < listing->count && !ex->err; i++) {
+        const dir_entry_t *entry = &listing->entries[i];
+        size_t mark;
+        
+        if (!pattern_match(p, entry->name, entry->len)) {
+            continue;
+        }
+        
+        mark = path_push(ex, entry->name, entry->len);
+        if (!last || ex->trailing_slash) {
+            if (!is_directory(ex, entry->type)) {
+                path_pop(ex, mark);
+                continue;
+            }
+        }
+        
+        if (last) {
+            emit_path(ex);
+        } else {
+            path_push(ex, p->sep, p->sep_len);
+            walk(ex, level + 1);
+        }
+        path_pop(ex, mark);
+    }
+    
+    dircache_release(listing);
+}
+
+static int compare_paths(const void *a, const void *b) {
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+/* ~ ou ~utilisateur en tête du motif */
+static const char *expand_pattern_tilde(const char *arg) {
+    const char *slash = strchr(arg, '/');
+    size_t name_len = slash ? (size_t)(slash - arg - 1) : strlen(arg + 1);
+    const char *home = NULL;
+    char *result;
+    
+    if (name_len == 0) {
+        home = getenv("HOME");
+    } else {
+        char *user = strndup(arg + 1, name_len);
+        struct passwd *pw = (user != NULL) ? getpwnam(user) : NULL;
+        free(user);
+        if (pw != NULL) {
+            home = pw->pw_dir;
+        }
+    }
+    if (home == NULL) {
+        return arg;
+    }
+    
+    result = arena_alloc(&line_arena, strlen(home) + strlen(arg + 1 + name_len) + 1);
+    if (result == NULL) {
+        return arg;
+    }
+    strcpy(result, home);
+    strcat(result, arg + 1 + name_len);
+    return result;
+}
+
+/* Moteur interne : ajoute à out les chemins triés qui correspondent à arg */
+static int expand_builtin(const char *arg, command_t *out) {
+    expand_t ex;
+    const char *pattern = (arg[0] == '~') ? expand_pattern_tilde(arg) : arg;
+    const char *start;
+    int start_argc = out->argc;
+    int n = 0;
+    
+    memset(&ex, 0, sizeof(ex));
+    ex.out = out;
+    
+    ex.comps = arena_alloc(&line_arena, sizeof(pattern_t) * (strlen(pattern) / 2 + 1));
+    if (ex.comps == NULL) {
+        return -1;
+    }
+    
+    /* Découpe en composants, chacun suivi de ses '/' recopiés tels quels */
+    start = pattern + strspn(pattern, "/");
+    path_push(&ex, pattern, start - pattern);
+    while (*start != '\0') {
+        const char *end = strchrnul(start, '/');
+        pattern_t *comp = &ex.comps[n++];
+        
+        if (compile_pattern(comp, start, end - start) < 0) {
+            free(ex.path);
+            return -1;
+        }
+        comp->globstar = (end - start == 2 && start[0] == '*' && start[1] == '*');
+        comp->sep = end;
+        comp->sep_len = strspn(end, "/");
+        start = end + comp->sep_len;
+    }
+    ex.ncomps = n;
+    ex.trailing_slash = (n > 0 && ex.comps[n - 1].sep_len > 0);
+    
+    if (ex.ncomps > 0 && !ex.err) {
+        walk(&ex, 0);
+    }
+    free(ex.path);
+    
+    if (ex.err) {
+        return -1;
+    }
+    
+    /* Chaque répertoire est déjà trié ; sur plusieurs niveaux l'ordre du
+     * chemin complet peut différer (a-/x avant a/x) : trié comme par glob(3) */
+    if ((ex.ncomps > 1 || ex.trailing_slash) && ex.found > 1) {
+        qsort(out->argv + start_argc, ex.found, sizeof(char *), compare_paths);
+    }
+    
+    return ex.found;
+}
+
+/* glob(3), avec les mêmes options qu'avant le moteur interne */
+static int expand_libc(const char *arg, command_t *out) {
+    glob_t globbuf;
+    int found = 0;
+    
+    if (glob(arg, GLOB_TILDE, NULL, &globbuf) != 0) {
         return 0;
     }
     
-    if (*pattern == '*') {
-        if (match_pattern(pattern + 1, str)) {
-            return 1;
+    for (size_t j = 0; j < globbuf.gl_pathc; j++) {
+        char *path = arena_strdup(&line_arena, globbuf.gl_pathv[j]);
+        if (path == NULL || add_argument(out, path) < 0) {
+            globfree(&globbuf);
+            return -1;
         }
-        if (*str && match_pattern(pattern, str + 1)) {
+        found++;
+    }
+    globfree(&globbuf);
+    
+    return found;
+}
+
+/* Comptabilise count motifs développés en elapsed ns au total */
+static void record_glob(glob_mode_t mode, int count, unsigned long long elapsed) {
+    unsigned long long each = elapsed / count;
+    
+    shell_stats.glob_count[mode] += count;
+    shell_stats.glob_ns[mode] += elapsed;
+    if (each > shell_stats.glob_max_ns[mode]) {
+        shell_stats.glob_max_ns[mode] = each;
+    }
+}
+
+/* Un '*', '?' ou '[' que ne protège pas un '\\' */
+static int has_wildcard(const char *arg) {
+    for (int j = 0; arg[j]; j++) {
+        if (arg[j] == '\\' && arg[j + 1] != '\0') {
+            j++;
+        } else if (arg[j] == '*' || arg[j] == '?' || arg[j] == '[') {
             return 1;
         }
+    }
+    return 0;
+}
+
+/* Retire sur place les '\\' qui protègent les caractères cités (voir expand_word()) */
+static char *remove_escapes(char *word) {
+    char *from = strchr(word, '\\');
+    char *to = from;
+    
+    if (from == NULL) {
+        return word;
+    }
+    while (*from != '\0') {
+        if (*from == '\\' && from[1] != '\0') {
+            from++;
+        }
+        *to++ = *from++;
+    }
+    *to = '\0';
+    return word;
+}
+
+/*
+ * Automate commun à plusieurs motifs d'un même répertoire (NFA en bitset).
+ * Chaque motif de n atomes occupe n + 1 bits consécutifs : le bit s est
+ * actif quand les s premiers atomes ont été reconnus. Un caractère fait
+ * avancer tous les motifs à la fois, par décalage et masque :
+ *     D = ((D << 1) & bytes[c]) | (D & stars)
+ * puis une '*' peut être franchie sans rien consommer (bits eps). Le bit 0
+ * d'un motif n'est jamais dans bytes[], le décalage ne déborde donc pas d'un
+ * motif sur le suivant.
+ * Les motifs que le préfixe, le suffixe et la longueur suffisent à trancher
+ * (*.c, lib*.so, Makefile) n'entrent pas dans l'automate. Les autres n'y
+ * démarrent que si ces tests passent, et la passe s'arrête dès qu'il ne
+ * reste que des états finaux sur une '*' : la suite du nom n'y changerait rien.
+ * L'automate coûte le même prix par octet quel que soit le nombre de motifs,
+ * mais ne profite pas du saut par memchr de pattern_match() : en dessous de
+ * MULTI_NFA_MIN motifs à comparer, chacun passe par pattern_match().
+ */
+
+#define MULTI_NFA_MIN 8
+typedef struct {
+    int nwords;                 /* 0 : aucun motif dans l'automate */
+    int npatterns;
+    const pattern_t *patterns;
+    uint64_t *bytes;            /* 256 × nwords : atomes qui acceptent c */
+    uint64_t *stars;            /* états qui bouclent sur tout caractère */
+    uint64_t *eps;              /* états atteints sans consommer (après '*') */
+    uint64_t *sticky;           /* états finaux qui bouclent : acquis */
+    uint64_t *state;
+    uint64_t *next;
+    int *first;                 /* bit de départ de chaque motif, -1 hors automate */
+    unsigned char *direct;      /* motifs comparés un à un par pattern_match() */
+    int *final;                 /* bit final de chaque motif */
+    unsigned char *hits;        /* résultat de multi_run() par motif */
+} multi_pattern_t;
+
+/* Un argument réuni avec d'autres : répertoire commun et résultats */
+typedef struct {
+    int group;                  /* -1 : développé seul */
+    const char *dir;
+    size_t dir_len;
+    const char *name;           /* dernier composant du motif */
+    char **paths;
+    int count;
+    int cap;
+} grouped_arg_t;
+
+#define BIT_SET(set, b) ((set)[(b) >> 6] |= (uint64_t)1 << ((b) & 63))
+#define BIT_TEST(set, b) (((set)[(b) >> 6] >> ((b) & 63)) & 1)
+
+static uint64_t *alloc_words(int nwords) {
+    uint64_t *words = arena_alloc(&line_arena, sizeof(uint64_t) * (nwords ? nwords : 1));
+    
+    if (words != NULL) {
+        memset(words, 0, sizeof(uint64_t) * (nwords ? nwords : 1));
+    }
+    return words;
+}
+
+/* Le préfixe, le suffixe et la longueur décident-ils seuls ? */
+static int prefilter_decides(const pattern_t *p) {
+    if (!p->has_wild) {
+        return 1;
+    }
+    return p->natoms == p->prefix_len + 1 + p->suffix_len &&
+           p->atoms[p->prefix_len].type == ATOM_STAR;
+}
+
+/* Franchit les '*' atteignables sans consommer (elles ne se suivent jamais) */
+static void multi_closure(const multi_pattern_t *m, uint64_t *set) {
+    uint64_t carry = 0;
+    
+    for (int w = 0; w < m->nwords; w++) {
+        uint64_t shifted = (set[w] << 1) | carry;
+        carry = set[w] >> 63;
+        set[w] |= shifted & m->eps[w];
+    }
+}
+
+static int multi_compile(multi_pattern_t *m, pattern_t *patterns, int npatterns) {
+    int ncomplex = 0;
+    int nbits = 0;
+    int bit = 0;
+    
+    for (int k = 0; k < npatterns; k++) {
+        if (!prefilter_decides(&patterns[k])) {
+            ncomplex++;
+            nbits += patterns[k].natoms + 1;
+        }
+    }
+    if (ncomplex < MULTI_NFA_MIN) {
+        nbits = 0;
+    }
+    
+    m->npatterns = npatterns;
+    m->patterns = patterns;
+    m->nwords = (nbits + 63) / 64;
+    m->bytes = alloc_words(256 * m->nwords);
+    m->stars = alloc_words(m->nwords);
+    m->eps = alloc_words(m->nwords);
+    m->sticky = alloc_words(m->nwords);
+    m->state = alloc_words(m->nwords);
+    m->next = alloc_words(m->nwords);
+    m->first = arena_alloc(&line_arena, sizeof(int) * npatterns);
+    m->final = arena_alloc(&line_arena, sizeof(int) * npatterns);
+    m->hits = arena_alloc(&line_arena, npatterns);
+    m->direct = arena_alloc(&line_arena, npatterns);
+    if (m->bytes == NULL || m->stars == NULL || m->eps == NULL || m->sticky == NULL ||
+        m->state == NULL || m->next == NULL || m->first == NULL || m->final == NULL ||
+        m->hits == NULL || m->direct == NULL) {
+        return -1;
+    }
+    
+    for (int k = 0; k < npatterns; k++) {
+        pattern_t *p = &patterns[k];
+        
+        m->first[k] = -1;
+        m->direct[k] = 0;
+        if (prefilter_decides(p)) {
+            continue;
+        }
+        if (nbits == 0) {
+            m->direct[k] = 1;
+            continue;
+        }
+        m->first[k] = bit;
+        
+        for (int a = 0; a < p->natoms; a++) {
+            int target = bit + a + 1;
+            
+            if (p->atoms[a].type == ATOM_STAR) {
+                BIT_SET(m->stars, target);
+                BIT_SET(m->eps, target);
+                continue;
+            }
+            for (int c = 1; c < 256; c++) {
+                if (atom_matches(p, &p->atoms[a], c)) {
+                    BIT_SET(m->bytes + c * m->nwords, target);
+                }
+            }
+        }
+        
+        m->final[k] = bit + p->natoms;
+        if (p->atoms[p->natoms - 1].type == ATOM_STAR) {
+            BIT_SET(m->sticky, m->final[k]);
+        }
+        bit += p->natoms + 1;
+    }
+    
+    return 0;
+}
+
+/* Cas courant d'un automate d'au plus 64 états : un seul mot, sans boucle */
+static uint64_t multi_run_word(const multi_pattern_t *m, uint64_t state, const char *name, size_t len) {
+    uint64_t stars = m->stars[0];
+    uint64_t eps = m->eps[0];
+    uint64_t sticky = m->sticky[0];
+    
+    state |= (state << 1) & eps;
+    for (size_t j = 0; j < len && (state & ~sticky) != 0; j++) {
+        state = ((state << 1) & m->bytes[(unsigned char)name[j]]) | (state & stars);
+        state |= (state << 1) & eps;
+    }
+    return state;
+}
+
+static void multi_run_words(multi_pattern_t *m, const char *name, size_t len) {
+    multi_closure(m, m->state);
+    
+    for (size_t j = 0; j < len; j++) {
+        const uint64_t *accept = m->bytes + (unsigned char)name[j] * m->nwords;
+        uint64_t carry = 0;
+        uint64_t pending = 0;
+        uint64_t *swap;
+        
+        for (int w = 0; w < m->nwords; w++) {
+            uint64_t shifted = (m->state[w] << 1) | carry;
+            carry = m->state[w] >> 63;
+            m->next[w] = (shifted & accept[w]) | (m->state[w] & m->stars[w]);
+        }
+        multi_closure(m, m->next);
+        
+        for (int w = 0; w < m->nwords; w++) {
+            pending |= m->next[w] & ~m->sticky[w];
+        }
+        
+        swap = m->state;
+        m->state = m->next;
+        m->next = swap;
+        if (!pending) {
+            break;
+        }
+    }
+}
+
+/* Compare name à tous les motifs ; m->hits[k] dit si le motif k convient */
+static int multi_run(multi_pattern_t *m, const char *name, size_t len) {
+    int started = 0;
+    int found = 0;
+    
+    memset(m->state, 0, sizeof(uint64_t) * (m->nwords ? m->nwords : 1));
+    for (int k = 0; k < m->npatterns; k++) {
+        if (m->direct[k]) {
+            m->hits[k] = pattern_match(&m->patterns[k], name, len);
+            continue;
+        }
+        m->hits[k] = pattern_prefilter(&m->patterns[k], name, len);
+        if (m->hits[k] && m->first[k] >= 0) {
+            BIT_SET(m->state, m->first[k]);
+            started = 1;
+        }
+    }
+    
+    if (started) {
+        if (m->nwords == 1) {
+            m->state[0] = multi_run_word(m, m->state[0], name, len);
+        } else {
+            multi_run_words(m, name, len);
+        }
+    }
+    
+    for (int k = 0; k < m->npatterns; k++) {
+        if (m->first[k] >= 0 && m->hits[k]) {
+            m->hits[k] = BIT_TEST(m->state, m->final[k]);
+        }
+        found += m->hits[k];
+    }
+    return found;
+}
+
+static int add_grouped_path(grouped_arg_t *g, const char *name, size_t len) {
+    char *path;
+    
+    if (g->count == g->cap) {
+        int cap = g->cap ? g->cap * 2 : 16;
+        char **grown = arena_grow(&line_arena, g->paths, sizeof(char *) * g->cap, sizeof(char *) * cap);
+        if (grown == NULL) {
+            return -1;
+        }
+        g->paths = grown;
+        g->cap = cap;
+    }
+    
+    path = arena_alloc(&line_arena, g->dir_len + len + 1);
+    if (path == NULL) {
+        return -1;
+    }
+    memcpy(path, g->dir, g->dir_len);
+    memcpy(path + g->dir_len, name, len + 1);
+    g->paths[g->count++] = path;
+    return 0;
+}
+
+/*
+ * Le motif ne porte-t-il que sur son dernier composant ? dir et name
+ * reçoivent alors le répertoire (avec ses '/', sans les '\\' des caractères
+ * cités) et ce composant.
+ */
+static int split_last_component(const char *pattern, grouped_arg_t *g) {
+    const char *slash = strrchr(pattern, '/');
+    const char *name = slash ? slash + 1 : pattern;
+    int escaped = 0;
+    
+    if (*name == '\0' || strcmp(name, "**") == 0) {
         return 0;
     }
+    for (const char *p = pattern; p < name; p++) {
+        if (*p == '\\') {
+            escaped = 1;
+            p++;
+        } else if (*p == '*' || *p == '?' || *p == '[') {
+            return 0;
+        }
+    }
     
-    if (*pattern == '?') {
-        if (*str == '\0') {
+    g->dir = pattern;
+    g->dir_len = name - pattern;
+    g->name = name;
+    if (escaped) {
+        char *dir = arena_alloc(&line_arena, g->dir_len + 1);
+        
+        if (dir == NULL) {
             return 0;
         }
-        return match_pattern(pattern + 1, str + 1);
+        memcpy(dir, pattern, g->dir_len);
+        dir[g->dir_len] = '\0';
+        g->dir = remove_escapes(dir);
+        g->dir_len = strlen(dir);
+    }
+    return 1;
+}
+
+/*
+ * Réunit les motifs de argv qui portent sur le même répertoire : celui-ci
+ * n'est lu qu'une fois et chaque entrée n'est passée qu'une fois dans
+ * l'automate commun. Renvoie le tableau par argument (group -1 pour ceux
+ * qui seront développés seuls), NULL en cas d'erreur.
+ */
+static grouped_arg_t *expand_groups(char **argv, int argc) {
+    grouped_arg_t *args = arena_alloc(&line_arena, sizeof(grouped_arg_t) * argc);
+    int *sizes = arena_alloc(&line_arena, sizeof(int) * argc);
+    int ngroups = 0;
+    
+    if (args == NULL || sizes == NULL) {
+        return NULL;
     }
+    memset(args, 0, sizeof(grouped_arg_t) * argc);
     
-    if (*pattern == '[') {
-        int skip;
-        if (match_bracket(pattern + 1, *str, &skip)) {
-            return match_pattern(pattern + skip + 1, str + 1);
+    for (int i = 0; i < argc; i++) {
+        grouped_arg_t *g = &args[i];
+        const char *pattern;
+        
+        g->group = -1;
+        if (!has_wildcard(argv[i])) {
+            continue;
         }
-        return 0;
+        pattern = (argv[i][0] == '~') ? expand_pattern_tilde(argv[i]) : argv[i];
+        if (!split_last_component(pattern, g)) {
+            continue;
+        }
+        
+        for (int j = 0; j < i; j++) {
+            if (args[j].dir != NULL && args[j].dir_len == g->dir_len &&
+                memcmp(args[j].dir, g->dir, g->dir_len) == 0) {
+                g->group = args[j].group;
+                break;
+            }
+        }
+        if (g->group < 0) {
+            g->group = ngroups;
+            sizes[ngroups++] = 0;
+        }
+        sizes[g->group]++;
     }
     
-    if (*pattern == *str) {
-        return match_pattern(pattern + 1, str + 1);
+    for (int group = 0; group < ngroups; group++) {
+        unsigned long long start = now_ns();
+        multi_pattern_t m;
+        pattern_t *patterns;
+        grouped_arg_t **members;
+        dir_listing_t *listing;
+        char *dir = NULL;
+        int n = 0;
+        
+        /* Un motif seul passe par le moteur habituel */
+        if (sizes[group] < 2) {
+            for (int i = 0; i < argc; i++) {
+                if (args[i].group == group) {
+                    args[i].group = -1;
+                }
+            }
+            continue;
+        }
+        
+        patterns = arena_alloc(&line_arena, sizeof(pattern_t) * sizes[group]);
+        members = arena_alloc(&line_arena, sizeof(grouped_arg_t *) * sizes[group]);
+        if (patterns == NULL || members == NULL) {
+            return NULL;
+        }
+        for (int i = 0; i < argc; i++) {
+            if (args[i].group != group) {
+                continue;
+            }
+            if (compile_pattern(&patterns[n], args[i].name, strlen(args[i].name)) < 0) {
+                return NULL;
+            }
+            members[n++] = &args[i];
+        }
+        if (multi_compile(&m, patterns, n) < 0) {
+            return NULL;
+        }
+        
+        dir = arena_alloc(&line_arena, members[0]->dir_len + 1);
+        if (dir == NULL) {
+            return NULL;
+        }
+        memcpy(dir, members[0]->dir, members[0]->dir_len);
+        dir[members[0]->dir_len] = '\0';
+        
+        listing = dircache_get(dir);
+        if (listing != NULL) {
+            for (int e = 0; e < listing->count; e++) {
+                const dir_entry_t *entry = &listing->entries[e];
+                
+                if (!multi_run(&m, entry->name, entry->len)) {
+                    continue;
+                }
+                for (int k = 0; k < n; k++) {
+                    if (m.hits[k] &&
+                        add_grouped_path(members[k], entry->name, entry->len) < 0) {
+                        dircache_release(listing);
+                        return NULL;
+                    }
+                }
+            }
+            dircache_release(listing);
+        }
+        
+        shell_stats.glob_groups++;
+        shell_stats.glob_grouped += n;
+        record_glob(GLOB_BUILTIN, n, now_ns() - start);
     }
     
+    return args;
+}
+
+/*
+ * Remplace argv par son expansion, prise dans line_arena : les mots sans
+ * motif sont repris tels quels, seuls les chemins trouvés sont copiés.
+ * Un motif sans correspondance reste tel quel. Les '\\' posés devant les
+ * caractères cités sont retirés des mots gardés. L'argv grandit autant que
+ * nécessaire ; la plus grande expansion est repérée (glob_start, glob_count)
+ * pour le découpage en lots.
+ */
+static int expand_wildcards(command_t *cmd) {
+    command_t expanded;
+    char **argv = cmd->argv;
+    int argc = cmd->argc;
+    grouped_arg_t *groups = NULL;
+    
+    if (shell_opts.glob_mode == GLOB_BUILTIN) {
+        groups = expand_groups(argv, argc);
+        if (groups == NULL) {
+            return -1;
+        }
+    }
+    
+    expanded.argc = 0;
+    expanded.argv_cap = argc + 1;
+    expanded.argv = arena_alloc(&line_arena, sizeof(char *) * expanded.argv_cap);
+    if (expanded.argv == NULL) {
+        return -1;
+    }
+    
+    for (int i = 0; i < argc; i++) {
+        glob_mode_t mode = shell_opts.glob_mode;
+        unsigned long long start;
+        int start_argc = expanded.argc;
+        int found;
+        
+        if (!has_wildcard(argv[i])) {
+            if (add_argument(&expanded, remove_escapes(argv[i])) < 0) {
+                return -1;
+            }
+            continue;
+        }
+        
+        if (groups != NULL && groups[i].group >= 0) {
+            /* Déjà comparé avec les autres motifs de son répertoire */
+            found = groups[i].count;
+            for (int k = 0; k < found; k++) {
+                if (add_argument(&expanded, groups[i].paths[k]) < 0) {
+                    return -1;
+                }
+            }
+        } else {
+            start = now_ns();
+            if (mode == GLOB_BUILTIN) {
+                found = expand_builtin(argv[i], &expanded);
+            } else {
+                found = expand_libc(argv[i], &expanded);
+            }
+            record_glob(mode, 1, now_ns() - start);
+        }
+        
+        if (found < 0) {
+            return -1;
+        }
+        if (found == 0) {
+            if (add_argument(&expanded, remove_escapes(argv[i])) < 0) {
+                return -1;
+            }
+        } else if (found > cmd->glob_count) {
+            cmd->glob_start = start_argc;
+            cmd->glob_count = found;
+        }
+    }
+    
+    expanded.argv[expanded.argc] = NULL;
+    
+    cmd->argv = expanded.argv;
+    cmd->argc = expanded.argc;
+    cmd->argv_cap = expanded.argv_cap;
+    return 0;
+}
+
+/*
+ * Développe cmd au moment de l'exécuter, avec les variables de cet instant
+ * et le contenu actuel des répertoires : chaque mot passe par expand_word()
+ * puis par les motifs, et les redirections reçoivent leur fichier ou leur
+ * contenu. Renvoie -1, message affiché, en cas d'erreur.
+ */
+int expand_command(command_t *cmd) {
+    command_t words;
+    
+    words.argc = 0;
+    words.argv_cap = cmd->argc + 1;
+    words.argv = arena_alloc(&line_arena, sizeof(char *) * words.argv_cap);
+    if (words.argv == NULL) {
+        return -1;
+    }
+    words.argv[0] = NULL;
+    
+    for (int i = 0; i < cmd->argc; i++) {
+        if (expand_word(cmd->argv[i], &words, 1) < 0) {
+            return -1;
+        }
+    }
+    cmd->argv = words.argv;
+    cmd->argc = words.argc;
+    cmd->argv_cap = words.argv_cap;
+    cmd->glob_start = 0;
+    cmd->glob_count = 0;
+    
+    if (expand_wildcards(cmd) < 0) {
+        return -1;
+    }
+    
+    for (redirection_t *redir = cmd->redirs; redir != NULL; redir = redir->next) {
+        command_t word;
+        char *argv[2];
+        
+        if (redir->type == REDIR_HEREDOC || redir->type == REDIR_HEREDOC_TABS) {
+            if (redir->expand && expand_here_document(redir) < 0) {
+                return -1;
+            }
+            continue;
+        }
+        if (redir->word == NULL) {
+            continue;
+        }
+        
+        /* Fichier ou texte de <<< : un seul mot, sans découpage ni motif */
+        word.argc = 0;
+        word.argv_cap = 2;
+        word.argv = argv;
+        if (expand_word(redir->word, &word, 0) < 0) {
+            return -1;
+        }
+        redir->word = remove_escapes(argv[0]);
+        if (redir->type == REDIR_STRING && here_string(redir) < 0) {
+            return -1;
+        }
+    }
     return 0;
 }